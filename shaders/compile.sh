@@ -1 +1,4 @@
-/home/marc/vulkan/1.4.313.0/x86_64/bin/slangc shader.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry vertMain -entry fragMain -o slang.spv
+/home/marc/vulkan/1.4.313.0/x86_64/bin/slangc shader.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry vertMain -entry vertMainPacked -entry fragMain -o slang.spv
+/home/marc/vulkan/1.4.313.0/x86_64/bin/slangc downsample.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry downsampleMain -o downsample.spv
+/home/marc/vulkan/1.4.313.0/x86_64/bin/slangc cull.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry cullMain -entry cullMeshletsMain -o cull.spv
+/home/marc/vulkan/1.4.313.0/x86_64/bin/slangc depth_pyramid.slang -target spirv -profile spirv_1_4 -emit-spirv-directly -fvk-use-entrypoint-name -entry depthMain -entry depthMultisampledMain -entry reduceMain -o depth_pyramid.spv
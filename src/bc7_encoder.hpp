@@ -0,0 +1,356 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// BC7 stores 4x4 texels in 16 bytes. Only mode 6 is encoded: a single subset
+// with RGBA endpoints of 7 bits plus a shared low bit each, and 4-bit indices.
+// It does well on gradients and alpha; blocks made of two or three distinct
+// colors would gain from the partitioned modes, which are not searched.
+constexpr size_t BC7_BLOCK_BYTES = 16;
+
+namespace bc7_detail {
+
+constexpr std::array<uint32_t, 16> WEIGHTS = {0,  4,  9,  13, 17, 21, 26, 30,
+                                              34, 38, 43, 47, 51, 55, 60, 64};
+
+using Color = std::array<uint8_t, 4>;
+using ColorF = std::array<float, 4>;
+
+inline uint8_t interpolate(uint8_t e0, uint8_t e1, uint32_t weight) {
+  return static_cast<uint8_t>(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+}
+
+struct Mode6Block {
+  // 7-bit endpoint values and their low bits
+  Color low0{}, low1{};
+  uint8_t p0 = 0, p1 = 0;
+  std::array<uint8_t, 16> indices{};
+  uint64_t error = std::numeric_limits<uint64_t>::max();
+
+  Color endpoint0() const { return expand(low0, p0); }
+  Color endpoint1() const { return expand(low1, p1); }
+
+  static Color expand(const Color &bits, uint8_t p) {
+    Color result;
+    for (int c = 0; c < 4; c++) {
+      result[c] = static_cast<uint8_t>(bits[c] << 1 | p);
+    }
+    return result;
+  }
+};
+
+// Gives every texel the nearest of the 16 interpolated colors and returns the
+// summed squared error.
+inline uint64_t assignIndices(const Color *texels, const Color &e0,
+                              const Color &e1,
+                              std::array<uint8_t, 16> &indices) {
+  std::array<Color, 16> palette;
+  for (size_t i = 0; i < palette.size(); i++) {
+    for (int c = 0; c < 4; c++) {
+      palette[i][c] = interpolate(e0[c], e1[c], WEIGHTS[i]);
+    }
+  }
+  uint64_t total = 0;
+  for (size_t t = 0; t < 16; t++) {
+    uint32_t best = std::numeric_limits<uint32_t>::max();
+    for (size_t i = 0; i < palette.size(); i++) {
+      uint32_t error = 0;
+      for (int c = 0; c < 4; c++) {
+        int d = int(texels[t][c]) - int(palette[i][c]);
+        error += static_cast<uint32_t>(d * d);
+      }
+      if (error < best) {
+        best = error;
+        indices[t] = static_cast<uint8_t>(i);
+      }
+    }
+    total += best;
+  }
+  return total;
+}
+
+// Tries the four low bit combinations for a pair of unquantized endpoints and
+// keeps the result in best when it beats it.
+inline void tryEndpoints(const Color *texels, const ColorF &e0,
+                         const ColorF &e1, Mode6Block &best) {
+  for (uint8_t p0 = 0; p0 < 2; p0++) {
+    for (uint8_t p1 = 0; p1 < 2; p1++) {
+      Mode6Block candidate;
+      candidate.p0 = p0;
+      candidate.p1 = p1;
+      for (int c = 0; c < 4; c++) {
+        candidate.low0[c] = static_cast<uint8_t>(
+          std::clamp(std::lround((e0[c] - p0) / 2.0f), 0l, 127l));
+        candidate.low1[c] = static_cast<uint8_t>(
+          std::clamp(std::lround((e1[c] - p1) / 2.0f), 0l, 127l));
+      }
+      candidate.error = assignIndices(texels, candidate.endpoint0(),
+                                      candidate.endpoint1(), candidate.indices);
+      if (candidate.error < best.error) {
+        best = candidate;
+      }
+    }
+  }
+}
+
+// Endpoints that minimize the squared error for fixed indices. Returns false
+// when every texel uses the same weight.
+inline bool fitEndpoints(const Color *texels,
+                         const std::array<uint8_t, 16> &indices, ColorF &e0,
+                         ColorF &e1) {
+  float a = 0.0f, b = 0.0f, c = 0.0f;
+  ColorF rhs0{}, rhs1{};
+  for (size_t t = 0; t < 16; t++) {
+    float w = WEIGHTS[indices[t]] / 64.0f;
+    a += (1.0f - w) * (1.0f - w);
+    b += (1.0f - w) * w;
+    c += w * w;
+    for (int ch = 0; ch < 4; ch++) {
+      rhs0[ch] += (1.0f - w) * texels[t][ch];
+      rhs1[ch] += w * texels[t][ch];
+    }
+  }
+  float det = a * c - b * b;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  for (int ch = 0; ch < 4; ch++) {
+    e0[ch] = std::clamp((c * rhs0[ch] - b * rhs1[ch]) / det, 0.0f, 255.0f);
+    e1[ch] = std::clamp((a * rhs1[ch] - b * rhs0[ch]) / det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+class BitWriter {
+public:
+  explicit BitWriter(uint8_t *out) : out(out) {
+    std::fill(out, out + BC7_BLOCK_BYTES, uint8_t{0});
+  }
+
+  void put(uint32_t value, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; i++, position++) {
+      if (value >> i & 1) {
+        out[position / 8] |= static_cast<uint8_t>(1 << (position % 8));
+      }
+    }
+  }
+
+private:
+  uint8_t *out;
+  uint32_t position = 0;
+};
+
+class BitReader {
+public:
+  explicit BitReader(const uint8_t *in) : in(in) {}
+
+  uint32_t get(uint32_t bits) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < bits; i++, position++) {
+      value |= static_cast<uint32_t>(in[position / 8] >> (position % 8) & 1)
+               << i;
+    }
+    return value;
+  }
+
+private:
+  const uint8_t *in;
+  uint32_t position = 0;
+};
+
+} // namespace bc7_detail
+
+// Encodes 16 RGBA8 texels, row by row, into one mode 6 block. Endpoints start
+// at the extremes along the principal axis of the colors and are refined by
+// least squares for the chosen indices.
+inline void encodeBc7Block(const uint8_t *rgba, uint8_t *block) {
+  using namespace bc7_detail;
+  const auto *texels = reinterpret_cast<const Color *>(rgba);
+
+  ColorF mean{};
+  for (size_t t = 0; t < 16; t++) {
+    for (int c = 0; c < 4; c++) {
+      mean[c] += texels[t][c] / 16.0f;
+    }
+  }
+  std::array<std::array<float, 4>, 4> covariance{};
+  ColorF minColor{255, 255, 255, 255}, maxColor{};
+  for (size_t t = 0; t < 16; t++) {
+    for (int i = 0; i < 4; i++) {
+      minColor[i] = std::min(minColor[i], float(texels[t][i]));
+      maxColor[i] = std::max(maxColor[i], float(texels[t][i]));
+      for (int j = 0; j < 4; j++) {
+        covariance[i][j] +=
+          (texels[t][i] - mean[i]) * (texels[t][j] - mean[j]);
+      }
+    }
+  }
+
+  // Power iteration from the bounding box diagonal
+  ColorF axis;
+  for (int c = 0; c < 4; c++) {
+    axis[c] = maxColor[c] - minColor[c];
+  }
+  for (int iteration = 0; iteration < 8; iteration++) {
+    ColorF next{};
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        next[i] += covariance[i][j] * axis[j];
+      }
+    }
+    float length = std::sqrt(next[0] * next[0] + next[1] * next[1] +
+                             next[2] * next[2] + next[3] * next[3]);
+    if (length < 1e-6f) {
+      break;
+    }
+    for (int c = 0; c < 4; c++) {
+      axis[c] = next[c] / length;
+    }
+  }
+
+  float lowest = std::numeric_limits<float>::max();
+  float highest = std::numeric_limits<float>::lowest();
+  for (size_t t = 0; t < 16; t++) {
+    float projection = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      projection += (texels[t][c] - mean[c]) * axis[c];
+    }
+    lowest = std::min(lowest, projection);
+    highest = std::max(highest, projection);
+  }
+  ColorF e0, e1;
+  for (int c = 0; c < 4; c++) {
+    e0[c] = std::clamp(mean[c] + lowest * axis[c], 0.0f, 255.0f);
+    e1[c] = std::clamp(mean[c] + highest * axis[c], 0.0f, 255.0f);
+  }
+
+  Mode6Block best;
+  tryEndpoints(texels, e0, e1, best);
+  for (int iteration = 0; iteration < 2 && best.error > 0; iteration++) {
+    if (!fitEndpoints(texels, best.indices, e0, e1)) {
+      break;
+    }
+    tryEndpoints(texels, e0, e1, best);
+  }
+
+  // The first index is stored without its top bit, which must be 0
+  if (best.indices[0] >= 8) {
+    std::swap(best.low0, best.low1);
+    std::swap(best.p0, best.p1);
+    for (auto &index : best.indices) {
+      index = static_cast<uint8_t>(15 - index);
+    }
+  }
+
+  BitWriter writer(block);
+  writer.put(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.put(best.low0[c], 7);
+    writer.put(best.low1[c], 7);
+  }
+  writer.put(best.p0, 1);
+  writer.put(best.p1, 1);
+  writer.put(best.indices[0], 3);
+  for (size_t t = 1; t < 16; t++) {
+    writer.put(best.indices[t], 4);
+  }
+}
+
+// Decodes a mode 6 block into 16 RGBA8 texels. Returns false for other modes.
+inline bool decodeBc7Mode6Block(const uint8_t *block, uint8_t *rgba) {
+  using namespace bc7_detail;
+  BitReader reader(block);
+  if (reader.get(7) != 1 << 6) {
+    return false;
+  }
+  Color low0, low1;
+  for (int c = 0; c < 4; c++) {
+    low0[c] = static_cast<uint8_t>(reader.get(7));
+    low1[c] = static_cast<uint8_t>(reader.get(7));
+  }
+  auto p0 = static_cast<uint8_t>(reader.get(1));
+  auto p1 = static_cast<uint8_t>(reader.get(1));
+  Color e0 = Mode6Block::expand(low0, p0);
+  Color e1 = Mode6Block::expand(low1, p1);
+  for (size_t t = 0; t < 16; t++) {
+    uint32_t index = reader.get(t == 0 ? 3 : 4);
+    for (int c = 0; c < 4; c++) {
+      rgba[t * 4 + c] = interpolate(e0[c], e1[c], WEIGHTS[index]);
+    }
+  }
+  return true;
+}
+
+inline uint32_t bc7BlockCount(uint32_t texels) { return (texels + 3) / 4; }
+
+// Encodes a whole image, blocks in row-major order. Edge blocks of sizes that
+// are not multiples of 4 repeat the last row and column. Block rows are spread
+// over pool when one is given.
+inline std::vector<uint8_t> encodeBc7(const uint8_t *rgba, uint32_t width,
+                                      uint32_t height, ThreadPool *pool) {
+  uint32_t blocksX = bc7BlockCount(width);
+  uint32_t blocksY = bc7BlockCount(height);
+  std::vector<uint8_t> blocks(static_cast<size_t>(blocksX) * blocksY *
+                              BC7_BLOCK_BYTES);
+  auto encodeRow = [&](size_t by) {
+    uint8_t texels[64];
+    for (uint32_t bx = 0; bx < blocksX; bx++) {
+      for (uint32_t t = 0; t < 16; t++) {
+        uint32_t x = std::min(bx * 4 + t % 4, width - 1);
+        uint32_t y = std::min(static_cast<uint32_t>(by) * 4 + t / 4, height - 1);
+        std::copy_n(&rgba[(static_cast<size_t>(y) * width + x) * 4], 4,
+                    &texels[t * 4]);
+      }
+      encodeBc7Block(texels,
+                     &blocks[(by * blocksX + bx) * BC7_BLOCK_BYTES]);
+    }
+  };
+  if (pool) {
+    pool->parallelFor(blocksY, encodeRow);
+  } else {
+    for (size_t by = 0; by < blocksY; by++) {
+      encodeRow(by);
+    }
+  }
+  return blocks;
+}
+
+// Peak signal to noise ratio of encoded blocks against the source image, over
+// all four channels. Infinite when they match exactly.
+inline double measureBc7Psnr(const uint8_t *rgba, uint32_t width,
+                             uint32_t height,
+                             const std::vector<uint8_t> &blocks) {
+  uint32_t blocksX = bc7BlockCount(width);
+  double squaredError = 0.0;
+  uint8_t decoded[64];
+  for (uint32_t by = 0; by < bc7BlockCount(height); by++) {
+    for (uint32_t bx = 0; bx < blocksX; bx++) {
+      decodeBc7Mode6Block(
+        &blocks[(static_cast<size_t>(by) * blocksX + bx) * BC7_BLOCK_BYTES],
+        decoded);
+      for (uint32_t t = 0; t < 16; t++) {
+        uint32_t x = bx * 4 + t % 4;
+        uint32_t y = by * 4 + t / 4;
+        if (x >= width || y >= height) {
+          continue;
+        }
+        for (int c = 0; c < 4; c++) {
+          double d = double(decoded[t * 4 + c]) -
+                     double(rgba[(static_cast<size_t>(y) * width + x) * 4 + c]);
+          squaredError += d * d;
+        }
+      }
+    }
+  }
+  double meanError = squaredError / (4.0 * width * height);
+  return meanError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanError)
+                         : std::numeric_limits<double>::infinity();
+}
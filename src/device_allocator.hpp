@@ -0,0 +1,358 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+class DeviceAllocator;
+
+// Buffers and linear images never share a block with optimal images, which
+// keeps every suballocation clear of bufferImageGranularity conflicts.
+enum class ResourceKind : uint32_t { Linear, Optimal, Count };
+
+namespace device_allocator_detail {
+struct Block {
+  vk::raii::DeviceMemory memory = nullptr;
+  vk::DeviceSize size = 0;
+  uint32_t memoryType = 0;
+  ResourceKind kind = ResourceKind::Linear;
+  bool dedicated = false;
+  // Host visible blocks stay mapped for their whole lifetime
+  void *mapped = nullptr;
+  // Free ranges by offset, adjacent ranges are always merged
+  std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+  vk::DeviceSize used = 0;
+  uint32_t allocationCount = 0;
+};
+} // namespace device_allocator_detail
+
+// A range of a DeviceAllocator block, returned to it on destruction. Must not
+// outlive the allocator.
+class Allocation {
+public:
+  Allocation() = default;
+  Allocation(std::nullptr_t) {}
+  ~Allocation() { release(); }
+
+  Allocation(Allocation &&other) noexcept { *this = std::move(other); }
+  Allocation &operator=(Allocation &&other) noexcept {
+    if (this != &other) {
+      release();
+      owner = std::exchange(other.owner, nullptr);
+      block = std::exchange(other.block, nullptr);
+      offsetInBlock = std::exchange(other.offsetInBlock, 0);
+      sizeInBlock = std::exchange(other.sizeInBlock, 0);
+    }
+    return *this;
+  }
+  Allocation(const Allocation &) = delete;
+  Allocation &operator=(const Allocation &) = delete;
+
+  explicit operator bool() const { return block != nullptr; }
+
+  vk::DeviceMemory memory() const { return *block->memory; }
+  vk::DeviceSize offset() const { return offsetInBlock; }
+  vk::DeviceSize size() const { return sizeInBlock; }
+  // Start of the allocation in host memory, null unless it is host visible.
+  void *mapped() const {
+    return block->mapped == nullptr
+             ? nullptr
+             : static_cast<std::byte *>(block->mapped) + offsetInBlock;
+  }
+
+  inline void release();
+
+private:
+  friend class DeviceAllocator;
+
+  DeviceAllocator *owner = nullptr;
+  device_allocator_detail::Block *block = nullptr;
+  vk::DeviceSize offsetInBlock = 0;
+  vk::DeviceSize sizeInBlock = 0;
+};
+
+// Suballocates device memory out of large blocks per memory type and resource
+// kind, so the number of vkAllocateMemory calls stays far below
+// maxMemoryAllocationCount. Free space is kept per block and handed out best
+// fit. Resources the driver wants dedicated memory for, or that would take up
+// a large part of a block, get a VkDeviceMemory of their own.
+class DeviceAllocator {
+public:
+  static constexpr vk::DeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+  void init(const vk::raii::Device &device,
+            const vk::raii::PhysicalDevice &physicalDevice) {
+    this->device = &device;
+    memoryProperties = physicalDevice.getMemoryProperties();
+    maxAllocationCount =
+      physicalDevice.getProperties().limits.maxMemoryAllocationCount;
+  }
+
+  // Allocates memory for buffer and binds it.
+  Allocation allocate(const vk::raii::Buffer &buffer,
+                      vk::MemoryPropertyFlags properties) {
+    auto requirements =
+      device->getBufferMemoryRequirements2<vk::MemoryRequirements2,
+                                           vk::MemoryDedicatedRequirements>(
+        vk::BufferMemoryRequirementsInfo2{.buffer = buffer});
+    const auto &dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+    vk::MemoryDedicatedAllocateInfo dedicatedInfo{.buffer = buffer};
+    Allocation allocation = allocate(
+      requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+      properties, ResourceKind::Linear,
+      dedicated.prefersDedicatedAllocation ||
+        dedicated.requiresDedicatedAllocation,
+      &dedicatedInfo);
+    buffer.bindMemory(allocation.memory(), allocation.offset());
+    return allocation;
+  }
+
+  // Allocates memory for image and binds it. preferDedicated asks for memory
+  // of its own, which some drivers use to lay out render targets better.
+  Allocation allocate(const vk::raii::Image &image,
+                      vk::MemoryPropertyFlags properties, vk::ImageTiling tiling,
+                      bool preferDedicated = false) {
+    auto requirements =
+      device->getImageMemoryRequirements2<vk::MemoryRequirements2,
+                                          vk::MemoryDedicatedRequirements>(
+        vk::ImageMemoryRequirementsInfo2{.image = image});
+    const auto &dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+    vk::MemoryDedicatedAllocateInfo dedicatedInfo{.image = image};
+    Allocation allocation = allocate(
+      requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+      properties,
+      tiling == vk::ImageTiling::eOptimal ? ResourceKind::Optimal
+                                          : ResourceKind::Linear,
+      preferDedicated || dedicated.prefersDedicatedAllocation ||
+        dedicated.requiresDedicatedAllocation,
+      &dedicatedInfo);
+    image.bindMemory(allocation.memory(), allocation.offset());
+    return allocation;
+  }
+
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          vk::MemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((typeFilter & (1u << i)) &&
+          (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+        return i;
+      }
+    }
+    throw std::runtime_error("failed to find suitable memory type!");
+  }
+
+  // Per memory type usage, and how fragmented the free space of the shared
+  // blocks is: 0% when it is one range, approaching 100% when it is scattered.
+  void printStats(std::ostream &out) const {
+    std::lock_guard lock(mutex);
+    out << "Device memory: " << blocks.size() << " of " << maxAllocationCount
+        << " allocations" << std::endl;
+    for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+      uint32_t blockCount = 0, dedicatedCount = 0, allocationCount = 0;
+      uint32_t freeRangeCount = 0;
+      vk::DeviceSize reserved = 0, used = 0, freeBytes = 0, largestFree = 0;
+      for (const auto &block : blocks) {
+        if (block->memoryType != type) {
+          continue;
+        }
+        (block->dedicated ? dedicatedCount : blockCount)++;
+        allocationCount += block->allocationCount;
+        reserved += block->size;
+        used += block->used;
+        if (block->dedicated) {
+          continue;
+        }
+        for (auto [offset, size] : block->freeRanges) {
+          freeRangeCount++;
+          freeBytes += size;
+          largestFree = std::max(largestFree, size);
+        }
+      }
+      if (blockCount + dedicatedCount == 0) {
+        continue;
+      }
+      double fragmentation =
+        freeBytes > 0 ? 100.0 * (1.0 - static_cast<double>(largestFree) /
+                                         static_cast<double>(freeBytes))
+                      : 0.0;
+      out << "  type " << type << " ("
+          << vk::to_string(memoryProperties.memoryTypes[type].propertyFlags)
+          << ", heap " << memoryProperties.memoryTypes[type].heapIndex
+          << "): " << blockCount << " blocks, " << dedicatedCount
+          << " dedicated, " << allocationCount << " allocations, "
+          << used / 1024 << " of " << reserved / 1024 << " KiB used, "
+          << freeRangeCount << " free ranges, " << fragmentation
+          << "% fragmented" << std::endl;
+    }
+  }
+
+private:
+  friend class Allocation;
+  using Block = device_allocator_detail::Block;
+
+  const vk::raii::Device *device = nullptr;
+  vk::PhysicalDeviceMemoryProperties memoryProperties;
+  uint32_t maxAllocationCount = 0;
+  std::vector<std::unique_ptr<Block>> blocks;
+  mutable std::mutex mutex;
+
+  vk::DeviceSize blockSize(uint32_t memoryType) const {
+    // Small heaps, such as a 256 MiB BAR window, get smaller blocks
+    vk::DeviceSize heapSize =
+      memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType]
+                                     .heapIndex]
+        .size;
+    return std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+  }
+
+  Allocation allocate(const vk::MemoryRequirements &requirements,
+                      vk::MemoryPropertyFlags properties, ResourceKind kind,
+                      bool dedicated,
+                      const vk::MemoryDedicatedAllocateInfo *dedicatedInfo) {
+    uint32_t memoryType =
+      findMemoryType(requirements.memoryTypeBits, properties);
+    std::lock_guard lock(mutex);
+    if (dedicated || requirements.size > blockSize(memoryType) / 2) {
+      Block &block = createBlock(memoryType, kind, requirements.size,
+                                 dedicatedInfo);
+      block.dedicated = true;
+      block.freeRanges.clear();
+      return take(block, 0, requirements.size);
+    }
+
+    // Best fit over the free ranges of every matching block
+    Block *bestBlock = nullptr;
+    vk::DeviceSize bestOffset = 0, bestWaste = ~0ull;
+    for (const auto &block : blocks) {
+      if (block->dedicated || block->memoryType != memoryType ||
+          block->kind != kind) {
+        continue;
+      }
+      for (auto [offset, size] : block->freeRanges) {
+        vk::DeviceSize aligned = alignUp(offset, requirements.alignment);
+        if (aligned + requirements.size > offset + size) {
+          continue;
+        }
+        vk::DeviceSize waste = size - requirements.size;
+        if (waste < bestWaste) {
+          bestBlock = block.get();
+          bestOffset = aligned;
+          bestWaste = waste;
+        }
+      }
+    }
+    if (bestBlock == nullptr) {
+      bestBlock = &createBlock(memoryType, kind, blockSize(memoryType), nullptr);
+      bestOffset = 0;
+    }
+    return take(*bestBlock, bestOffset, requirements.size);
+  }
+
+  Block &createBlock(uint32_t memoryType, ResourceKind kind,
+                     vk::DeviceSize size,
+                     const vk::MemoryDedicatedAllocateInfo *dedicatedInfo) {
+    auto block = std::make_unique<Block>();
+    block->memory = vk::raii::DeviceMemory(
+      *device, vk::MemoryAllocateInfo{.pNext = dedicatedInfo,
+                                      .allocationSize = size,
+                                      .memoryTypeIndex = memoryType});
+    block->size = size;
+    block->memoryType = memoryType;
+    block->kind = kind;
+    block->freeRanges[0] = size;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+        vk::MemoryPropertyFlagBits::eHostVisible) {
+      block->mapped = block->memory.mapMemory(0, size);
+    }
+    blocks.push_back(std::move(block));
+    return *blocks.back();
+  }
+
+  // Carves [offset, offset + size) out of the free range containing it.
+  Allocation take(Block &block, vk::DeviceSize offset, vk::DeviceSize size) {
+    if (!block.dedicated) {
+      auto range = std::prev(block.freeRanges.upper_bound(offset));
+      vk::DeviceSize rangeStart = range->first;
+      vk::DeviceSize rangeEnd = range->first + range->second;
+      block.freeRanges.erase(range);
+      if (offset > rangeStart) {
+        block.freeRanges[rangeStart] = offset - rangeStart;
+      }
+      if (offset + size < rangeEnd) {
+        block.freeRanges[offset + size] = rangeEnd - offset - size;
+      }
+    }
+    block.used += size;
+    block.allocationCount++;
+
+    Allocation allocation;
+    allocation.owner = this;
+    allocation.block = &block;
+    allocation.offsetInBlock = offset;
+    allocation.sizeInBlock = size;
+    return allocation;
+  }
+
+  void free(Block *block, vk::DeviceSize offset, vk::DeviceSize size) {
+    std::lock_guard lock(mutex);
+    block->used -= size;
+    block->allocationCount--;
+    if (!block->dedicated) {
+      auto next = block->freeRanges.lower_bound(offset);
+      if (next != block->freeRanges.end() && next->first == offset + size) {
+        size += next->second;
+        next = block->freeRanges.erase(next);
+      }
+      if (next != block->freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+          offset = previous->first;
+          size += previous->second;
+          block->freeRanges.erase(previous);
+        }
+      }
+      block->freeRanges[offset] = size;
+    }
+
+    // Empty blocks are returned to the driver, except the last shared block
+    // of a pool, which would likely be allocated again right away
+    if (block->allocationCount > 0) {
+      return;
+    }
+    bool keep = !block->dedicated &&
+                std::ranges::count_if(blocks, [&](const auto &other) {
+                  return !other->dedicated &&
+                         other->memoryType == block->memoryType &&
+                         other->kind == block->kind;
+                }) == 1;
+    if (!keep) {
+      std::erase_if(blocks,
+                    [&](const auto &other) { return other.get() == block; });
+    }
+  }
+
+  static vk::DeviceSize alignUp(vk::DeviceSize value,
+                                vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+};
+
+inline void Allocation::release() {
+  if (owner != nullptr) {
+    owner->free(block, offsetInBlock, sizeInBlock);
+  }
+  owner = nullptr;
+  block = nullptr;
+  offsetInBlock = 0;
+  sizeInBlock = 0;
+}
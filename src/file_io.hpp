@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. An empty or missing file leaves the
+// mapping closed.
+class MappedFile {
+public:
+  MappedFile() = default;
+  explicit MappedFile(const std::string &path) { open(path); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      close();
+      mapping = std::exchange(other.mapping, nullptr);
+      length = std::exchange(other.length, 0);
+    }
+    return *this;
+  }
+
+  bool open(const std::string &path) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER fileSize{};
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+      HANDLE fileMapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (fileMapping != nullptr) {
+        mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(fileMapping);
+        length = mapping ? static_cast<size_t>(fileSize.QuadPart) : 0;
+      }
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat fileStat{};
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+      void *view = mmap(nullptr, static_cast<size_t>(fileStat.st_size),
+                        PROT_READ, MAP_PRIVATE, fd, 0);
+      if (view != MAP_FAILED) {
+        mapping = view;
+        length = static_cast<size_t>(fileStat.st_size);
+      }
+    }
+    ::close(fd);
+#endif
+    return mapping != nullptr;
+  }
+
+  void close() {
+    if (mapping == nullptr) {
+      return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, length);
+#endif
+    mapping = nullptr;
+    length = 0;
+  }
+
+  bool isOpen() const { return mapping != nullptr; }
+  const std::byte *data() const { return static_cast<const std::byte *>(mapping); }
+  size_t size() const { return length; }
+
+private:
+  void *mapping = nullptr;
+  size_t length = 0;
+};
+
+// Writes to a temporary file next to path and renames it over path, so readers
+// never observe a partially written file.
+inline bool writeFileAtomic(const std::string &path, const void *data,
+                            size_t size) {
+  std::string tempPath = path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file.write(static_cast<const char *>(data),
+               static_cast<std::streamsize>(size));
+    if (!file.good()) {
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::filesystem::remove(tempPath, error);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The phases of a frame, in the order drawFrame() executes them.
+enum class FramePhase : uint32_t {
+  FenceWait,
+  Acquire,
+  UpdateUniforms,
+  Record,
+  Submit,
+  Present,
+  Count
+};
+
+constexpr std::array<const char *, static_cast<size_t>(FramePhase::Count)>
+  FRAME_PHASE_NAMES = {"fence_wait", "acquire",   "update_uniforms",
+                       "record",     "submit",    "present"};
+
+struct LatencySummary {
+  size_t samples = 0;
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+// Per-phase CPU timings of every recorded frame, in milliseconds. lap() charges
+// the time since the previous lap to a phase, so timing a frame costs one clock
+// read per phase.
+class FrameStats {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void setRecording(bool enabled) { recording = enabled; }
+  bool isRecording() const { return recording; }
+
+  void beginFrame() {
+    frameStart = Clock::now();
+    lastLap = frameStart;
+    current.fill(-1.0);
+  }
+
+  void lap(FramePhase phase) {
+    auto now = Clock::now();
+    double &slot = current[static_cast<size_t>(phase)];
+    slot = std::max(slot, 0.0) +
+           std::chrono::duration<double, std::milli>(now - lastLap).count();
+    lastLap = now;
+  }
+
+  void endFrame() {
+    if (!recording) {
+      return;
+    }
+    for (size_t i = 0; i < current.size(); i++) {
+      if (current[i] >= 0.0) {
+        phaseSamples[i].push_back(current[i]);
+      }
+    }
+    frameSamples.push_back(
+      std::chrono::duration<double, std::milli>(Clock::now() - frameStart)
+        .count());
+  }
+
+  // Samples for a measurement that is not one of the CPU phases, such as a
+  // GPU pass time read back from queries.
+  void recordMetric(const std::string &name, double value) {
+    if (recording) {
+      metricSamples[name].push_back(value);
+    }
+  }
+
+  size_t frameCount() const { return frameSamples.size(); }
+
+  // Phases that were never timed (acquire and present when headless) are left
+  // out.
+  std::map<std::string, LatencySummary> summarize() const {
+    std::map<std::string, LatencySummary> result;
+    for (size_t i = 0; i < phaseSamples.size(); i++) {
+      if (!phaseSamples[i].empty()) {
+        result[FRAME_PHASE_NAMES[i]] = summarize(phaseSamples[i]);
+      }
+    }
+    if (!frameSamples.empty()) {
+      result["frame"] = summarize(frameSamples);
+    }
+    for (const auto &[name, samples] : metricSamples) {
+      result[name] = summarize(samples);
+    }
+    return result;
+  }
+
+  std::string toJson() const {
+    std::ostringstream out;
+    out << "{\n  \"frames\": " << frameCount() << ",\n  \"phases\": {";
+    bool first = true;
+    for (const auto &[name, summary] : summarize()) {
+      out << (first ? "\n" : ",\n") << "    \"" << name << "\": {"
+          << "\"samples\": " << summary.samples
+          << ", \"mean\": " << summary.mean << ", \"p50\": " << summary.p50
+          << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99
+          << ", \"max\": " << summary.max << "}";
+      first = false;
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+  }
+
+  // Reads the "phases" object of a report written by toJson(). Only that
+  // layout is understood, this is not a general JSON parser.
+  static std::map<std::string, LatencySummary>
+  parseJson(const std::string &json) {
+    std::map<std::string, LatencySummary> result;
+    size_t pos = json.find("\"phases\"");
+    if (pos == std::string::npos) {
+      return result;
+    }
+    pos = json.find('{', pos);
+    while (pos != std::string::npos) {
+      size_t nameStart = json.find('"', pos + 1);
+      size_t objectEnd = json.find('}', pos + 1);
+      if (nameStart == std::string::npos || nameStart > objectEnd) {
+        break;
+      }
+      size_t nameEnd = json.find('"', nameStart + 1);
+      size_t bodyStart = json.find('{', nameEnd);
+      size_t bodyEnd = json.find('}', bodyStart);
+      if (nameEnd == std::string::npos || bodyStart == std::string::npos ||
+          bodyEnd == std::string::npos) {
+        break;
+      }
+      std::string body = json.substr(bodyStart, bodyEnd - bodyStart);
+      LatencySummary &summary =
+        result[json.substr(nameStart + 1, nameEnd - nameStart - 1)];
+      summary.samples = static_cast<size_t>(readField(body, "samples"));
+      summary.mean = readField(body, "mean");
+      summary.p50 = readField(body, "p50");
+      summary.p95 = readField(body, "p95");
+      summary.p99 = readField(body, "p99");
+      summary.max = readField(body, "max");
+      pos = bodyEnd;
+    }
+    return result;
+  }
+
+  // Prints current against baseline and returns false when any phase's p50 or
+  // p95 got slower by more than tolerancePercent.
+  static bool compare(const std::map<std::string, LatencySummary> &baseline,
+                      const std::map<std::string, LatencySummary> &current,
+                      double tolerancePercent, std::ostream &out) {
+    bool withinTolerance = true;
+    for (const auto &[name, now] : current) {
+      auto it = baseline.find(name);
+      if (it == baseline.end()) {
+        out << name << ": not in baseline\n";
+        continue;
+      }
+      const LatencySummary &before = it->second;
+      double p50Delta = percentChange(before.p50, now.p50);
+      double p95Delta = percentChange(before.p95, now.p95);
+      bool regressed =
+        p50Delta > tolerancePercent || p95Delta > tolerancePercent;
+      withinTolerance = withinTolerance && !regressed;
+      out << name << ": p50 " << before.p50 << " -> " << now.p50 << " ms ("
+          << signedPercent(p50Delta) << "), p95 " << before.p95 << " -> "
+          << now.p95 << " ms (" << signedPercent(p95Delta) << ")"
+          << (regressed ? "  REGRESSION" : "") << "\n";
+    }
+    return withinTolerance;
+  }
+
+private:
+  bool recording = false;
+  Clock::time_point frameStart;
+  Clock::time_point lastLap;
+  std::array<double, static_cast<size_t>(FramePhase::Count)> current{};
+  std::array<std::vector<double>, static_cast<size_t>(FramePhase::Count)>
+    phaseSamples;
+  std::vector<double> frameSamples;
+  std::map<std::string, std::vector<double>> metricSamples;
+
+  static LatencySummary summarize(std::vector<double> samples) {
+    LatencySummary summary;
+    summary.samples = samples.size();
+    std::sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (double sample : samples) {
+      total += sample;
+    }
+    summary.mean = total / static_cast<double>(samples.size());
+    summary.p50 = percentile(samples, 50.0);
+    summary.p95 = percentile(samples, 95.0);
+    summary.p99 = percentile(samples, 99.0);
+    summary.max = samples.back();
+    return summary;
+  }
+
+  // Nearest-rank percentile of already sorted samples
+  static double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = static_cast<size_t>(
+      std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  }
+
+  static double readField(const std::string &body, const std::string &key) {
+    size_t pos = body.find("\"" + key + "\"");
+    if (pos == std::string::npos) {
+      return 0.0;
+    }
+    pos = body.find(':', pos);
+    return std::strtod(body.c_str() + pos + 1, nullptr);
+  }
+
+  static double percentChange(double before, double now) {
+    return before > 0.0 ? (now - before) / before * 100.0 : 0.0;
+  }
+
+  static std::string signedPercent(double value) {
+    std::ostringstream out;
+    out.precision(1);
+    out << std::fixed << (value >= 0.0 ? "+" : "") << value << "%";
+    return out.str();
+  }
+};
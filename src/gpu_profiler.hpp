@@ -0,0 +1,211 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+// GPU work inside recordCommandBuffer(), each pass ends at a timestamp and
+// starts where the previous one ended.
+enum class GpuPass : uint32_t {
+  Cull,              // first cull dispatch, empty without --gpu-culling
+  Barriers,          // attachment layout transitions
+  Draw,              // beginRendering up to the last (early) draw
+  Occlusion,         // depth pyramid and late cull (--occlusion-culling)
+  LateDraw,          // newly visible instances (--occlusion-culling)
+  Resolve,           // endRendering, i.e. the MSAA resolve and stores
+  PresentTransition, // final layout transition of the target image
+  Count
+};
+
+constexpr std::array<const char *, static_cast<size_t>(GpuPass::Count)>
+  GPU_PASS_NAMES = {"gpu_cull",      "gpu_barriers",
+                    "gpu_draw",      "gpu_occlusion",
+                    "gpu_late_draw", "gpu_resolve",
+                    "gpu_present_transition"};
+
+struct GpuFrameReport {
+  std::array<double, static_cast<size_t>(GpuPass::Count)> passMs{};
+  double totalMs = 0.0;
+
+  bool hasStatistics = false;
+  uint64_t inputAssemblyVertices = 0;
+  uint64_t inputAssemblyPrimitives = 0;
+  uint64_t vertexInvocations = 0;
+  uint64_t clippingInvocations = 0;
+  uint64_t clippingPrimitives = 0;
+  uint64_t fragmentInvocations = 0;
+  // Fragment shader invocations per pixel of the render target
+  double overdraw = 0.0;
+};
+
+// Timestamp and pipeline statistics queries, one set per frame in flight.
+// Results are collected after that frame's fence has signalled, so reading
+// them never waits on the GPU; a frame whose results are not available yet is
+// dropped rather than waited for.
+class GpuProfiler {
+public:
+  // statistics off leaves pipeline statistics out even where the device has
+  // them, for frames whose queries could not span their secondaries.
+  void init(const vk::raii::Device &device,
+            const vk::raii::PhysicalDevice &physicalDevice,
+            uint32_t queueFamilyIndex, uint32_t framesInFlight,
+            bool statistics = true) {
+    auto queueFamilies = physicalDevice.getQueueFamilyProperties();
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    if (validBits == 0) {
+      throw std::runtime_error("graphics queue does not support timestamps!");
+    }
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    frameCount = framesInFlight;
+
+    timestampPool = vk::raii::QueryPool(
+      device, vk::QueryPoolCreateInfo{.queryType = vk::QueryType::eTimestamp,
+                                      .queryCount = TIMESTAMPS_PER_FRAME *
+                                                    framesInFlight});
+
+    if (statistics && physicalDevice.getFeatures().pipelineStatisticsQuery) {
+      statisticsPool = vk::raii::QueryPool(
+        device,
+        vk::QueryPoolCreateInfo{.queryType = vk::QueryType::ePipelineStatistics,
+                                .queryCount = framesInFlight,
+                                .pipelineStatistics = STATISTICS});
+    }
+    pending.assign(framesInFlight, false);
+  }
+
+  bool isEnabled() const { return frameCount > 0; }
+
+  // Resets this frame's queries and writes the frame start timestamp. Must be
+  // recorded outside of a render pass.
+  void beginFrame(const vk::raii::CommandBuffer &commandBuffer,
+                  uint32_t frame) {
+    if (!isEnabled()) {
+      return;
+    }
+    commandBuffer.resetQueryPool(timestampPool, frame * TIMESTAMPS_PER_FRAME,
+                                 TIMESTAMPS_PER_FRAME);
+    if (*statisticsPool) {
+      commandBuffer.resetQueryPool(statisticsPool, frame, 1);
+    }
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                  timestampPool, frame * TIMESTAMPS_PER_FRAME);
+    pending[frame] = true;
+  }
+
+  // Marks this frame's queries as pending without recording anything, for a
+  // command buffer recorded by an earlier frame in the same slot that is
+  // submitted again.
+  void replayFrame(uint32_t frame) {
+    if (isEnabled()) {
+      pending[frame] = true;
+    }
+  }
+
+  void endPass(const vk::raii::CommandBuffer &commandBuffer, uint32_t frame,
+               GpuPass pass) {
+    if (!isEnabled()) {
+      return;
+    }
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                  timestampPool,
+                                  frame * TIMESTAMPS_PER_FRAME + 1 +
+                                    static_cast<uint32_t>(pass));
+  }
+
+  // Statistics secondaries executed within beginStatistics() and
+  // endStatistics() have to inherit.
+  vk::QueryPipelineStatisticFlags inheritedStatistics() const {
+    return isEnabled() && *statisticsPool ? STATISTICS
+                                          : vk::QueryPipelineStatisticFlags{};
+  }
+
+  void beginStatistics(const vk::raii::CommandBuffer &commandBuffer,
+                       uint32_t frame) {
+    if (isEnabled() && *statisticsPool) {
+      commandBuffer.beginQuery(statisticsPool, frame, {});
+    }
+  }
+
+  void endStatistics(const vk::raii::CommandBuffer &commandBuffer,
+                     uint32_t frame) {
+    if (isEnabled() && *statisticsPool) {
+      commandBuffer.endQuery(statisticsPool, frame);
+    }
+  }
+
+  // Call once the frame's fence has signalled and before it is re-recorded.
+  std::optional<GpuFrameReport> collect(uint32_t frame,
+                                        vk::Extent2D renderExtent) {
+    if (!isEnabled() || !pending[frame]) {
+      return std::nullopt;
+    }
+    pending[frame] = false;
+
+    auto [timestampResult, timestamps] = timestampPool.getResults<uint64_t>(
+      frame * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME,
+      TIMESTAMPS_PER_FRAME * sizeof(uint64_t), sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64);
+    if (timestampResult != vk::Result::eSuccess) {
+      return std::nullopt;
+    }
+
+    GpuFrameReport report;
+    for (size_t pass = 0; pass < report.passMs.size(); pass++) {
+      report.passMs[pass] = ticksToMs(timestamps[pass], timestamps[pass + 1]);
+    }
+    report.totalMs = ticksToMs(timestamps.front(), timestamps.back());
+
+    if (*statisticsPool) {
+      auto [statisticsResult, statistics] =
+        statisticsPool.getResults<uint64_t>(
+          frame, 1, STATISTICS_COUNT * sizeof(uint64_t),
+          STATISTICS_COUNT * sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+      if (statisticsResult == vk::Result::eSuccess) {
+        // Results come back in the bit order of STATISTICS
+        report.hasStatistics = true;
+        report.inputAssemblyVertices = statistics[0];
+        report.inputAssemblyPrimitives = statistics[1];
+        report.vertexInvocations = statistics[2];
+        report.clippingInvocations = statistics[3];
+        report.clippingPrimitives = statistics[4];
+        report.fragmentInvocations = statistics[5];
+        double pixels = static_cast<double>(renderExtent.width) *
+                        static_cast<double>(renderExtent.height);
+        report.overdraw =
+          pixels > 0.0 ? static_cast<double>(report.fragmentInvocations) / pixels
+                       : 0.0;
+      }
+    }
+    return report;
+  }
+
+private:
+  static constexpr uint32_t TIMESTAMPS_PER_FRAME =
+    1 + static_cast<uint32_t>(GpuPass::Count);
+  static constexpr vk::QueryPipelineStatisticFlags STATISTICS =
+    vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+    vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+  static constexpr uint32_t STATISTICS_COUNT = 6;
+
+  vk::raii::QueryPool timestampPool = nullptr;
+  vk::raii::QueryPool statisticsPool = nullptr;
+  std::vector<bool> pending;
+  uint32_t frameCount = 0;
+  uint64_t timestampMask = ~0ull;
+  float timestampPeriod = 1.0f;
+
+  double ticksToMs(uint64_t begin, uint64_t end) const {
+    uint64_t ticks = ((end & timestampMask) - (begin & timestampMask)) &
+                     timestampMask;
+    return static_cast<double>(ticks) * timestampPeriod / 1.0e6;
+  }
+};
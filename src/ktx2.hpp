@@ -0,0 +1,296 @@
+#pragma once
+
+#include "file_io.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+// Minimal KTX2 (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html)
+// for single 2D images with a mip chain and no supercompression. Formats are
+// Vulkan VkFormat values; only those listed in Ktx2Format are written.
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K',  'T',  'X', ' ',  '2',
+                                         '0',  0xBB, '\r', '\n', 0x1A, '\n'};
+
+// Key/value entry holding, as 8 bytes, the hash writeKtx2() was given of
+// what the texture was made from
+constexpr char KTX2_SOURCE_HASH_KEY[] = "HelloVulkanSourceHash";
+
+enum class Ktx2Format : uint32_t {
+  R8G8B8A8Srgb = 43,   // VK_FORMAT_R8G8B8A8_SRGB
+  Bc7SrgbBlock = 146,  // VK_FORMAT_BC7_SRGB_BLOCK
+};
+
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80);
+
+struct Ktx2LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+namespace ktx2_detail {
+
+// Block size in bytes and texels per block side
+struct FormatInfo {
+  uint32_t blockBytes;
+  uint32_t blockSize;
+};
+
+inline FormatInfo formatInfo(Ktx2Format format) {
+  return format == Ktx2Format::Bc7SrgbBlock ? FormatInfo{16, 4}
+                                            : FormatInfo{4, 1};
+}
+
+// Levels of the full chain down to 1x1, as mipLevelCount() counts them
+inline uint32_t fullChainLevels(uint32_t width, uint32_t height) {
+  return static_cast<uint32_t>(std::bit_width(std::max(width, height)));
+}
+
+// Data format descriptor: one basic block, sRGB BT.709 color
+inline std::vector<uint32_t> dataFormatDescriptor(Ktx2Format format) {
+  constexpr uint32_t MODEL_RGBSDA = 1, MODEL_BC7 = 134;
+  constexpr uint32_t PRIMARIES_BT709 = 1, TRANSFER_SRGB = 2;
+  constexpr uint32_t CHANNEL_LINEAR = 0x10;
+
+  struct Sample {
+    uint32_t bitOffset, bitLength, channel, upper;
+  };
+  std::vector<Sample> samples;
+  uint32_t model, blockDimensions, bytesPlane0;
+  if (format == Ktx2Format::Bc7SrgbBlock) {
+    model = MODEL_BC7;
+    blockDimensions = 3 | 3 << 8;
+    bytesPlane0 = 16;
+    samples.push_back({0, 127, 0, 0xFFFFFFFF});
+  } else {
+    model = MODEL_RGBSDA;
+    blockDimensions = 0;
+    bytesPlane0 = 4;
+    // Alpha is never sRGB encoded
+    samples = {{0, 7, 0, 255},
+               {8, 7, 1, 255},
+               {16, 7, 2, 255},
+               {24, 7, 15 | CHANNEL_LINEAR, 255}};
+  }
+
+  uint32_t blockBytes = 24 + 16 * static_cast<uint32_t>(samples.size());
+  std::vector<uint32_t> words = {
+    4 + blockBytes,    // dfdTotalSize
+    0,                 // vendorId, descriptorType: Khronos basic
+    2 | blockBytes << 16, // versionNumber, descriptorBlockSize
+    model | PRIMARIES_BT709 << 8 | TRANSFER_SRGB << 16,
+    blockDimensions,
+    bytesPlane0,
+    0};
+  for (const auto &sample : samples) {
+    words.push_back(sample.bitOffset | sample.bitLength << 16 |
+                    sample.channel << 24);
+    words.push_back(0); // sample position
+    words.push_back(0); // lower
+    words.push_back(sample.upper);
+  }
+  return words;
+}
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Key/value data with the one source hash entry: its byte length, the key
+// with its terminating NUL, the value, and padding to 4 bytes
+inline std::vector<std::byte> keyValueData(uint64_t sourceHash) {
+  uint32_t length = sizeof(KTX2_SOURCE_HASH_KEY) + sizeof(sourceHash);
+  std::vector<std::byte> data(alignUp(sizeof(length) + length, 4));
+  std::memcpy(data.data(), &length, sizeof(length));
+  std::memcpy(data.data() + sizeof(length), KTX2_SOURCE_HASH_KEY,
+              sizeof(KTX2_SOURCE_HASH_KEY));
+  std::memcpy(data.data() + sizeof(length) + sizeof(KTX2_SOURCE_HASH_KEY),
+              &sourceHash, sizeof(sourceHash));
+  return data;
+}
+
+} // namespace ktx2_detail
+
+// Writes a 2D texture whose levels[i] is mip level i, largest first. Level
+// data is stored smallest first, as the specification recommends. sourceHash
+// goes into the key/value data, for Ktx2File::sourceHash() to compare with
+// the source when the file is loaded.
+inline bool writeKtx2(const std::string &path, Ktx2Format format,
+                      uint32_t width, uint32_t height,
+                      const std::vector<std::vector<uint8_t>> &levels,
+                      uint64_t sourceHash) {
+  using namespace ktx2_detail;
+  std::vector<uint32_t> dfd = dataFormatDescriptor(format);
+  std::vector<std::byte> kvd = keyValueData(sourceHash);
+
+  Ktx2Header header{};
+  std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  header.vkFormat = static_cast<uint32_t>(format);
+  // Both formats are made of bytes
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = static_cast<uint32_t>(levels.size());
+  header.dfdByteOffset = static_cast<uint32_t>(
+    sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2LevelIndex));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+  header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+  header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+  std::vector<Ktx2LevelIndex> index(levels.size());
+  // Level data starts at multiples of the block size and of 4
+  uint64_t alignment = formatInfo(format).blockBytes;
+  uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+  for (size_t level = levels.size(); level-- > 0;) {
+    offset = alignUp(offset, alignment);
+    index[level] = {offset, levels[level].size(), levels[level].size()};
+    offset += levels[level].size();
+  }
+
+  std::vector<std::byte> bytes(offset);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  std::memcpy(bytes.data() + sizeof(header), index.data(),
+              index.size() * sizeof(Ktx2LevelIndex));
+  std::memcpy(bytes.data() + header.dfdByteOffset, dfd.data(),
+              header.dfdByteLength);
+  std::memcpy(bytes.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+  for (size_t level = 0; level < levels.size(); level++) {
+    std::memcpy(bytes.data() + index[level].byteOffset, levels[level].data(),
+                levels[level].size());
+  }
+  return writeFileAtomic(path, bytes.data(), bytes.size());
+}
+
+// A mapped KTX2 file of the kind writeKtx2() produces.
+class Ktx2File {
+public:
+  // Fails when the file is missing, malformed, or not a 2D, single layer,
+  // uncompressed texture in one of the Ktx2Format formats. More levels than
+  // the full chain would shift the extent past its width in width().
+  // Key/value data that runs past the file fails too.
+  bool open(const std::string &path) {
+    using namespace ktx2_detail;
+    if (!file.open(path) || file.size() < sizeof(Ktx2Header)) {
+      file.close();
+      return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    auto format = static_cast<Ktx2Format>(header.vkFormat);
+    if (std::memcmp(header.identifier, KTX2_IDENTIFIER,
+                    sizeof(KTX2_IDENTIFIER)) != 0 ||
+        (format != Ktx2Format::Bc7SrgbBlock &&
+         format != Ktx2Format::R8G8B8A8Srgb) ||
+        header.pixelWidth == 0 || header.pixelHeight == 0 ||
+        header.pixelDepth > 1 || header.layerCount > 1 ||
+        header.faceCount != 1 || header.levelCount == 0 ||
+        header.levelCount >
+          fullChainLevels(header.pixelWidth, header.pixelHeight) ||
+        header.supercompressionScheme != 0 ||
+        sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2LevelIndex) >
+          file.size() ||
+        !readSourceHash()) {
+      close();
+      return false;
+    }
+    levelIndex.resize(header.levelCount);
+    std::memcpy(levelIndex.data(), file.data() + sizeof(Ktx2Header),
+                levelIndex.size() * sizeof(Ktx2LevelIndex));
+
+    FormatInfo info = formatInfo(format);
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+      const auto &entry = levelIndex[level];
+      uint64_t blocksX = (width(level) + info.blockSize - 1) / info.blockSize;
+      uint64_t blocksY = (height(level) + info.blockSize - 1) / info.blockSize;
+      if (entry.byteOffset > file.size() ||
+          entry.byteLength > file.size() - entry.byteOffset ||
+          entry.byteLength != blocksX * blocksY * info.blockBytes ||
+          entry.byteOffset % info.blockBytes != 0) {
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    file.close();
+    levelIndex.clear();
+    hash = 0;
+  }
+
+  bool isOpen() const { return file.isOpen(); }
+  uint32_t vkFormat() const { return header.vkFormat; }
+  uint32_t levelCount() const { return header.levelCount; }
+  // The hash writeKtx2() stored, 0 when the file has none
+  uint64_t sourceHash() const { return hash; }
+  uint32_t width(uint32_t level = 0) const {
+    return std::max(header.pixelWidth >> level, 1u);
+  }
+  uint32_t height(uint32_t level = 0) const {
+    return std::max(header.pixelHeight >> level, 1u);
+  }
+
+  std::span<const std::byte> level(uint32_t level) const {
+    return {file.data() + levelIndex[level].byteOffset,
+            static_cast<size_t>(levelIndex[level].byteLength)};
+  }
+
+private:
+  MappedFile file;
+  Ktx2Header header{};
+  std::vector<Ktx2LevelIndex> levelIndex;
+  uint64_t hash = 0;
+
+  // Walks the key/value entries for KTX2_SOURCE_HASH_KEY. Returns false when
+  // an entry runs past the data.
+  bool readSourceHash() {
+    hash = 0;
+    uint64_t offset = header.kvdByteOffset;
+    uint64_t end = offset + header.kvdByteLength;
+    if (end > file.size()) {
+      return false;
+    }
+    while (end - offset >= sizeof(uint32_t)) {
+      uint32_t length;
+      std::memcpy(&length, file.data() + offset, sizeof(length));
+      offset += sizeof(length);
+      if (length > end - offset) {
+        return false;
+      }
+      if (length == sizeof(KTX2_SOURCE_HASH_KEY) + sizeof(hash) &&
+          std::memcmp(file.data() + offset, KTX2_SOURCE_HASH_KEY,
+                      sizeof(KTX2_SOURCE_HASH_KEY)) == 0) {
+        std::memcpy(&hash,
+                    file.data() + offset + sizeof(KTX2_SOURCE_HASH_KEY),
+                    sizeof(hash));
+      }
+      offset = std::min(ktx2_detail::alignUp(offset + length, 4), end);
+    }
+    return true;
+  }
+};
@@ -12,15 +12,22 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <chrono>
+#include <deque>
+#include <future>
 #include <ios>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <memory>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <unordered_map>
 #include <vector>
@@ -38,11 +45,48 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tinyobjloader/tiny_obj_loader.h>
 
+#include "bc7_encoder.hpp"
+#include "device_allocator.hpp"
+#include "file_io.hpp"
+#include "frame_stats.hpp"
+#include "gpu_profiler.hpp"
+#include "hash.hpp"
+#include "ktx2.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimize.hpp"
+#include "mesh_simplify.hpp"
+#include "meshlet.hpp"
+#include "mip_generator.hpp"
+#include "obj_parser.hpp"
+#include "pipeline_cache.hpp"
+#include "texture_table.hpp"
+#include "thread_pool.hpp"
+#include "upload_context.hpp"
+#include "vertex_weld.hpp"
+
 constexpr uint32_t WIDTH = 800;
 constexpr uint32_t HEIGHT = 600;
 constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+constexpr uint32_t DEFAULT_HEADLESS_FRAMES = 600;
+constexpr uint32_t BENCHMARK_WARMUP_FRAMES = 60;
+constexpr float BENCHMARK_FRAME_TIME = 1.0f / 60.0f;
+constexpr uint32_t GPU_PROFILE_LOG_INTERVAL = 120;
+// Instance counts --bench-instances steps through
+constexpr std::array<uint32_t, 6> INSTANCE_SWEEP = {1,    10,     100,
+                                                    1000, 10'000, 100'000};
+// Distance between neighbouring instances on their grid
+constexpr float INSTANCE_SPACING = 1.5f;
 const std::string MODEL_PATH = "models/viking_room.obj";
+const std::string MODEL_CACHE_PATH = MODEL_PATH + ".meshcache";
 const std::string TEXTURE_PATH = "textures/viking_room.png";
+// Baked from TEXTURE_PATH with --bake-texture; used instead when present,
+// baked from the current TEXTURE_PATH and its format is supported
+const std::string TEXTURE_KTX2_PATH = "textures/viking_room.ktx2";
+// Bump whenever the bake's mip filtering or encoder changes, so older bakes
+// no longer match their source
+constexpr uint64_t TEXTURE_BAKE_VERSION = 1;
+// Driver pipeline cache, kept between runs of the same device and driver
+const std::string PIPELINE_CACHE_PATH = "shaders/slang_shaders.pipelinecache";
 
 const std::vector validationLayers = {"VK_LAYER_KHRONOS_validation"};
 
@@ -85,10 +129,427 @@ template <> struct std::hash<Vertex> {
   }
 };
 
+// Hashes the attribute values rather than the struct, whose glm members may
+// carry padding. Adding 0.0f turns -0.0f into 0.0f, so vertices that compare
+// equal also hash equal.
+struct VertexHash {
+    uint64_t operator()(const Vertex &vertex) const noexcept {
+        const float key[8] = {
+            vertex.pos.x + 0.0f,      vertex.pos.y + 0.0f,
+            vertex.pos.z + 0.0f,      vertex.color.r + 0.0f,
+            vertex.color.g + 0.0f,    vertex.color.b + 0.0f,
+            vertex.texCoord.x + 0.0f, vertex.texCoord.y + 0.0f};
+        return xxhash64(key, sizeof(key));
+    }
+};
+
+inline Vertex makeObjVertex(const ObjData &obj, const ObjCorner &corner) {
+    Vertex vertex{};
+    vertex.pos = {obj.positions[3 * corner.position + 0],
+                  obj.positions[3 * corner.position + 1],
+                  obj.positions[3 * corner.position + 2]};
+    if (corner.texcoord != OBJ_NO_TEXCOORD) {
+        // 1.0f used to flip texture axis for alignment
+        vertex.texCoord = {obj.texcoords[2 * corner.texcoord + 0],
+                           1.0f - obj.texcoords[2 * corner.texcoord + 1]};
+    }
+    vertex.color = {1.0f, 1.0f, 1.0f};
+    return vertex;
+}
+
+// Compact alternative to Vertex, 12 instead of 32 bytes. Positions are unorm16
+// within the mesh bounds, the dequantization is folded into the model matrix;
+// texture coordinates are unorm16 and the constant color is dropped.
+struct PackedVertex {
+    uint16_t pos[4];
+    uint16_t texCoord[2];
+
+    static vk::VertexInputBindingDescription getBindingDescription() {
+        return { 0, sizeof(PackedVertex), vk::VertexInputRate::eVertex };
+    }
+
+    static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        return {
+            vk::VertexInputAttributeDescription( 0, 0, vk::Format::eR16G16B16A16Unorm, offsetof(PackedVertex, pos)),
+            vk::VertexInputAttributeDescription( 1, 0, vk::Format::eR16G16Unorm, offsetof(PackedVertex, texCoord))
+        };
+    }
+};
+
+inline uint16_t quantizeUnorm16(float value) {
+    return static_cast<uint16_t>(
+        std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+// Decoded RGBA8 pixels as returned by stb_image.
+struct ImagePixels {
+  std::unique_ptr<stbi_uc, void (*)(void *)> pixels{nullptr, stbi_image_free};
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+inline ImagePixels loadImagePixels(const std::string &path) {
+  int texWidth, texHeight, texChannels;
+  stbi_uc *pixels = stbi_load(path.c_str(), &texWidth, &texHeight,
+                              &texChannels, STBI_rgb_alpha);
+  if (!pixels) {
+    throw std::runtime_error("failed to load texture image!");
+  }
+  ImagePixels image;
+  image.pixels.reset(pixels);
+  image.width = static_cast<uint32_t>(texWidth);
+  image.height = static_cast<uint32_t>(texHeight);
+  return image;
+}
+
+// What a bake of the image file stores and its loader compares: the file's
+// bytes, seeded with the bake settings.
+inline uint64_t textureBakeHash(const MappedFile &source) {
+  return xxhash64(source.data(), source.size(), TEXTURE_BAKE_VERSION);
+}
+
+// What the texture loader produced: a baked KTX2 file, or decoded pixels when
+// there is none.
+struct TextureSource {
+  Ktx2File ktx;
+  ImagePixels image;
+};
+
+// Device buffers of a mesh and what drawing it needs to know about them.
+struct GpuMesh {
+  vk::raii::Buffer vertexBuffer = nullptr;
+  Allocation vertexBufferAllocation = nullptr;
+  vk::raii::Buffer indexBuffer = nullptr;
+  Allocation indexBufferAllocation = nullptr;
+  // Of the full mesh, the first of lods
+  uint32_t indexCount = 0;
+  vk::IndexType indexType = vk::IndexType::eUint32;
+  // Ranges of the index buffer, finest first
+  std::vector<MeshLod> lods;
+  bool packed = false;
+  glm::mat4 dequantize{1.0f};
+  // Center in the coordinates of the vertex buffer, so packed meshes have it
+  // in [0, 1] like their positions; radius in model units
+  glm::vec4 boundingSphere{0.0f};
+  // Meshlets for meshlet culling, with points and cone axes in the
+  // coordinates of the vertex buffer like boundingSphere
+  vk::raii::Buffer meshletBuffer = nullptr;
+  Allocation meshletBufferAllocation = nullptr;
+  uint32_t meshletCount = 0;
+};
+
+// Centered on the bounds, with the radius reaching the farthest position.
+// Looser than the smallest enclosing sphere, but found in two passes.
+glm::vec4 boundingSphere(std::span<const Vertex> vertices) {
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+  for (const auto &vertex : vertices) {
+    boundsMin = glm::min(boundsMin, vertex.pos);
+    boundsMax = glm::max(boundsMax, vertex.pos);
+  }
+  glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+  float radiusSquared = 0.0f;
+  for (const auto &vertex : vertices) {
+    glm::vec3 offset = vertex.pos - center;
+    radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+  }
+  return glm::vec4(center, std::sqrt(radiusSquared));
+}
+
+// Positions alone, as the mesh optimizers take them
+std::vector<MeshPosition> meshPositions(std::span<const Vertex> vertices) {
+  std::vector<MeshPosition> positions;
+  positions.reserve(vertices.size());
+  for (const auto &vertex : vertices) {
+    positions.push_back({vertex.pos.x, vertex.pos.y, vertex.pos.z});
+  }
+  return positions;
+}
+
+constexpr uint32_t NO_TABLE_SLOT = ~0u;
+
+struct Texture {
+  vk::raii::Image image = nullptr;
+  Allocation allocation = nullptr;
+  vk::raii::ImageView view = nullptr;
+  uint32_t mipLevels = 1;
+  // Index in the texture table while frames may sample the texture
+  uint32_t tableSlot = NO_TABLE_SLOT;
+};
+
+// Per level views and descriptor set of one compute mip dispatch, which the
+// uploads retain until it has run
+struct DownsampleBinding {
+  std::vector<vk::raii::ImageView> storageViews;
+  vk::raii::DescriptorSet set = nullptr;
+};
+
+// Push constants of shaders/downsample.slang
+struct DownsampleConstants {
+  uint32_t baseWidth;
+  uint32_t baseHeight;
+  uint32_t mipCount;
+  uint32_t groupCount;
+};
+
+// Levels one downsample dispatch produces a chain of, 4096x4096 down to 1x1
+constexpr uint32_t DOWNSAMPLE_MAX_LEVELS = 13;
+// Side of the level 0 tile one workgroup reduces
+constexpr uint32_t DOWNSAMPLE_TILE = 64;
+// Dispatches the downsample descriptor pool has sets for until their uploads
+// finish; one more waits for them
+constexpr uint32_t DOWNSAMPLE_MAX_TEXTURES = 16;
+// Largest channel difference, in 8 bit codes, between the GPU mip paths
+constexpr int MIP_TOLERANCE = 2;
+
+// Stand-ins drawn until the real assets are resident: a quad facing the
+// camera with a plain grey texture.
+const std::array<Vertex, 4> PLACEHOLDER_VERTICES = {
+  {{{-0.5f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
+   {{0.5f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}},
+   {{0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 0.0f}},
+   {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}}}};
+const std::array<uint32_t, 6> PLACEHOLDER_INDICES = {0, 1, 2, 2, 3, 0};
+constexpr uint32_t PLACEHOLDER_TEXEL = 0xff808080;
+
 struct UniformBufferObject {
   alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
   alignas(16) glm::mat4 proj;
+  // Levels of detail of the mesh drawn, for the cull pass to choose from
+  alignas(16) MeshLod lods[MAX_MESH_LODS];
+  uint32_t lodCount;
+  // See lodDistanceScale()
+  float lodDistanceScale;
+};
+
+// How the mip chain of a decoded texture is made. Auto blits on the GPU when
+// the format supports linear filtering and falls back to the CPU otherwise.
+// Compute writes every level in one dispatch of shaders/downsample.slang.
+enum class MipMode { Auto, Blit, Cpu, Compute };
+
+const char *mipModeName(MipMode mode) {
+  switch (mode) {
+  case MipMode::Blit:
+    return "blit";
+  case MipMode::Cpu:
+    return "cpu";
+  case MipMode::Compute:
+    return "compute";
+  default:
+    return "auto";
+  }
+}
+
+// Per instance data of shader.slang, read by SV_InstanceID.
+struct InstanceData {
+  glm::mat4 model;
+};
+
+// Instances stand on a square grid around the origin, each turned a little
+// further than the last so the copies are told apart. A single instance is
+// the untransformed model.
+glm::vec3 instancePosition(uint32_t index, uint32_t count) {
+  auto side = static_cast<uint32_t>(std::ceil(std::sqrt(double(count))));
+  float offset = 0.5f * static_cast<float>(side - 1);
+  return glm::vec3(
+    (static_cast<float>(index % side) - offset) * INSTANCE_SPACING,
+    (static_cast<float>(index / side) - offset) * INSTANCE_SPACING, 0.0f);
+}
+
+// Distance from the origin the grid of count instances stays within, the
+// model's own reach of about a unit included
+float instanceGridReach(uint32_t count) {
+  auto side = static_cast<uint32_t>(std::ceil(std::sqrt(double(count))));
+  return 0.5f * static_cast<float>(side - 1) * INSTANCE_SPACING *
+           std::sqrt(2.0f) +
+         1.0f;
+}
+
+glm::mat4 instanceTransform(uint32_t index, uint32_t count) {
+  return glm::rotate(
+    glm::translate(glm::mat4(1.0f), instancePosition(index, count)),
+    static_cast<float>(index) * 0.7f, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+// Position of the instance nearest to point, going by the grid alone. When
+// the last row is partial the position may be that of a missing instance,
+// which is only ever nearer.
+glm::vec3 nearestInstancePosition(glm::vec3 point, uint32_t count) {
+  auto side = static_cast<uint32_t>(std::ceil(std::sqrt(double(count))));
+  float offset = 0.5f * static_cast<float>(side - 1);
+  auto nearest = [&](float coordinate) {
+    float cell = std::round(coordinate / INSTANCE_SPACING + offset);
+    return (std::clamp(cell, 0.0f, static_cast<float>(side - 1)) - offset) *
+           INSTANCE_SPACING;
+  };
+  return glm::vec3(nearest(point.x), nearest(point.y), 0.0f);
+}
+
+// The coarsest of lods whose error, scaled by distanceScale, is within
+// distance; the first, the full mesh, when none is. Matches selectLod() in
+// shaders/cull.slang.
+uint32_t selectLod(std::span<const MeshLod> lods, float distance,
+                   float distanceScale) {
+  uint32_t selected = 0;
+  for (uint32_t i = 1; i < lods.size(); i++) {
+    if (lods[i].error * distanceScale <= distance) {
+      selected = i;
+    }
+  }
+  return selected;
+}
+
+// Push constants of shader.slang, set per draw
+struct DrawConstants {
+  // Texture table slot to sample
+  uint32_t materialId;
+  // 1 when the instance index goes through the cull pass's list of visible
+  // instances, 0 when it is the instance itself
+  uint32_t instanceList;
+};
+
+// Dispatches of shaders/cull.slang: frustum culling alone, either half of
+// occlusion culling, or frustum and cone culling of every instance's meshlets
+// after setting up the meshlet draws
+enum class CullPhase : uint32_t {
+  Frustum,
+  Early,
+  Late,
+  Meshlets,
+  // Sets up the meshlet phase's draws, before it runs
+  MeshletDraws
+};
+
+// Push constants of shaders/cull.slang
+struct CullConstants {
+  // GpuMesh::boundingSphere of the mesh drawn
+  glm::vec4 boundingSphere;
+  uint32_t instanceCount;
+  CullPhase phase;
+  // Draws each phase has room for
+  uint32_t drawCapacity;
+  // Instances each list of visible instances has room for
+  uint32_t listCapacity;
+  uint32_t pyramidLevels;
+  uint32_t pyramidWidth;
+  uint32_t pyramidHeight;
+  uint32_t meshletCount;
+  // Instances the meshlet phase's dispatch covers per row of workgroups,
+  // each row looping over the instances one of them apart
+  uint32_t instanceRows;
+};
+
+// Counters shaders/cull.slang fills in, the draw counts first
+struct CullStats {
+  // Instances drawn by the frustum or early phase, the early phase's being
+  // last frame's visible instances still in the frustum, or instance
+  // meshlets drawn by the meshlet phase
+  uint32_t earlyDraws;
+  // Instances the late phase found newly visible
+  uint32_t lateDraws;
+  uint32_t occluded;
+  uint32_t outsideFrustum;
+  // Meshlets facing away from the camera
+  uint32_t backfacing;
+};
+
+// Instances, or meshlets of one instance, one workgroup of the cull pass
+// tests
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+// Rows of workgroups the meshlet phase dispatches at most, the smallest
+// maxComputeWorkGroupCount devices report
+constexpr uint32_t CULL_MAX_INSTANCE_ROWS = 65535;
+
+// Push constants of shaders/depth_pyramid.slang
+struct PyramidConstants {
+  uint32_t width;
+  uint32_t height;
+  uint32_t depthWidth;
+  uint32_t depthHeight;
+  uint32_t sampleCount;
+};
+
+// Side of the 2D workgroups of shaders/depth_pyramid.slang
+constexpr uint32_t PYRAMID_WORKGROUP_SIZE = 8;
+// Levels the pyramid descriptor pool has sets for, enough for 32768 pixels
+constexpr uint32_t PYRAMID_MAX_LEVELS = 16;
+
+// Largest power of two not above value, which is at least 1
+inline uint32_t previousPowerOfTwo(uint32_t value) {
+  uint32_t result = 1;
+  while (result <= value / 2) {
+    result *= 2;
+  }
+  return result;
+}
+
+struct AppOptions {
+  // Render into offscreen images instead of a window surface and swapchain.
+  bool headless = false;
+  // Number of frames to render before exiting, 0 runs until the window closes.
+  uint32_t frameCount = 0;
+  // Time vertex welding on the model and a synthetic mesh instead of running.
+  bool benchWeld = false;
+  uint32_t syntheticTriangles = 4'000'000;
+  // Time OBJ parsing of this file across thread counts instead of running.
+  std::string benchObjPath;
+  // Measured frames rendered on a fixed timestep along a scripted camera path,
+  // 0 disables benchmarking.
+  uint32_t benchmarkFrames = 0;
+  // Where the JSON report goes, stdout when empty.
+  std::string benchmarkOutput;
+  // Report from an earlier run to compare against.
+  std::string benchmarkBaseline;
+  // Allowed p50/p95 slowdown against the baseline, in percent.
+  double benchmarkTolerance = 10.0;
+  // Time the GPU passes of each frame and count pipeline statistics.
+  bool gpuProfile = false;
+  // Copies of the model drawn with one instanced draw.
+  uint32_t instances = 1;
+  // Measure frames at each of INSTANCE_SWEEP instead of running.
+  bool benchInstances = false;
+  // Cull instances against the frustum in a compute pass and draw the
+  // survivors with an indirect draw count.
+  bool gpuCulling = false;
+  // Also cull instances hidden behind last frame's visible ones, in two
+  // phases around a depth pyramid. Implies gpuCulling.
+  bool occlusionCulling = false;
+  // Cull each instance's meshlets against the frustum and by their normal
+  // cones instead, drawing each surviving meshlet indirectly. Implies
+  // gpuCulling; does not combine with occlusionCulling.
+  bool meshletCulling = false;
+  // Screen space error, in pixels, a coarser level of detail may add. 0
+  // always draws the full mesh.
+  float lodErrorPixels = 0.0f;
+  // Record the mesh draws on this many threads, into secondary command
+  // buffers, one draw per run of instances sharing a level of detail. 0
+  // records one instanced draw on the main thread. Does not combine with
+  // gpuCulling, whose draws are already a single indirect one.
+  uint32_t recordThreads = 0;
+  // Record each frame's command buffer once per swapchain image and frame
+  // slot and submit it again for as long as the scene stays the same,
+  // instead of recording every frame. Does not combine with recordThreads,
+  // whose secondaries are recorded for one submission.
+  bool cachedCommands = false;
+  // Upload the mesh as PackedVertex when its texture coordinates allow it.
+  bool packedVertices = false;
+  // Print device memory usage per memory type once initialized.
+  bool memoryStats = false;
+  // Record all startup uploads into one submission; when off, every copy,
+  // transition and mip chain is submitted and waited for on its own.
+  bool uploadBatching = true;
+  // Ignore TEXTURE_KTX2_PATH and decode TEXTURE_PATH.
+  bool noKtx2 = false;
+  // Load and save PIPELINE_CACHE_PATH; when off, every pipeline is compiled
+  // from scratch.
+  bool pipelineCache = true;
+  MipMode mipMode = MipMode::Auto;
+  // Time the CPU mip kernels and both texture upload paths instead of running.
+  bool benchMips = false;
+  // Bake this image into a BC7 KTX2 file with mips instead of running.
+  std::string bakeTextureInput;
+  std::string bakeTextureOutput;
 };
 
 #ifdef NDEBUG
@@ -99,14 +560,34 @@ constexpr bool enableValidationLayers = true;
 
 class HelloTriangleApplication {
     public:
+    explicit HelloTriangleApplication(const AppOptions &options)
+        : options(options) {}
+
     void run() {
-        initWindow();
+        if (options.benchMips) {
+            initVulkan();
+            benchmarkTextureUpload();
+            device.waitIdle();
+            cleanup();
+            return;
+        }
+        launchTime = std::chrono::steady_clock::now();
+        startAssetLoading();
+        if (!options.headless) {
+            initWindow();
+        }
         initVulkan();
-        mainLoop();
+        if (options.benchInstances) {
+            runInstanceSweep();
+        } else {
+            mainLoop();
+        }
         cleanup();
     }
 
     private:
+    AppOptions options;
+    ThreadPool workerPool;
     GLFWwindow *window = nullptr;
 
     vk::raii::Context context;
@@ -116,7 +597,12 @@ class HelloTriangleApplication {
 
     vk::raii::PhysicalDevice physicalDevice = nullptr;
     vk::raii::Device device = nullptr;
+    DeviceAllocator allocator;
     uint32_t graphicsIndex = ~0;
+    // Uploads go to a transfer-only queue family when there is one, and to
+    // the graphics queue otherwise
+    uint32_t transferIndex = ~0;
+    vk::raii::Queue transferQueue = nullptr;
     vk::raii::Queue graphicsQueue = nullptr;
     vk::raii::Queue presentQueue = nullptr;
 
@@ -126,12 +612,49 @@ class HelloTriangleApplication {
     vk::Extent2D swapChainExtent;
     std::vector<vk::raii::ImageView> swapChainImageViews;
 
+    // Headless mode renders into these instead of swapchain images
+    std::vector<vk::raii::Image> offscreenImages;
+    std::vector<Allocation> offscreenImageAllocations;
+
+    // Every pipeline is built through it
+    PipelineCache pipelineCache;
+
     vk::raii::DescriptorSetLayout descriptorSetLayout = nullptr;
 	vk::raii::PipelineLayout pipelineLayout = nullptr;
     vk::raii::Pipeline graphicsPipeline = nullptr;
+    // Variant for PackedVertex input, only built with --packed-vertices
+    vk::raii::Pipeline packedGraphicsPipeline = nullptr;
+
+    // Compute mip generation; the uploads retain sets from the pool, so it
+    // comes before them
+    vk::raii::DescriptorSetLayout downsampleSetLayout = nullptr;
+    vk::raii::PipelineLayout downsamplePipelineLayout = nullptr;
+    vk::raii::Pipeline downsamplePipeline = nullptr;
+    vk::raii::DescriptorPool downsampleDescriptorPool = nullptr;
+    vk::raii::Buffer downsampleCounter = nullptr;
+    Allocation downsampleCounterAllocation = nullptr;
 
     vk::raii::CommandPool commandPool = nullptr;
     std::vector<vk::raii::CommandBuffer> commandBuffers;
+    // Multi-threaded recording: for each frame slot and recording thread, in
+    // that order, a pool of its own holding one secondary command buffer.
+    // The pool is reset whole before the thread records the slot again.
+    std::vector<vk::raii::CommandPool> recordPools;
+    std::vector<vk::raii::CommandBuffer> recordCommandBuffers;
+    vk::Format recordDepthFormat = vk::Format::eUndefined;
+    // Cached commands: for each swapchain image and frame slot, in that
+    // order, a primary recorded once and submitted again. The slot picks the
+    // uniform buffer and descriptor sets, the image the attachment. Each is
+    // recorded again once sceneVersion, or for direct draws directLod,
+    // differs from what it was recorded with.
+    std::vector<vk::raii::CommandBuffer> cachedCommandBuffers;
+    std::vector<uint64_t> cachedCommandVersions;
+    std::vector<uint32_t> cachedCommandLods;
+    // Bumped whenever recorded commands go stale: new assets or instance
+    // count. Swapchain recreation allocates the cached buffers anew.
+    uint64_t sceneVersion = 1;
+
+    UploadContext uploads;
 
     std::vector<vk::raii::Semaphore> presentCompleteSemaphores;
     std::vector<vk::raii::Semaphore> renderFinishedSemaphores;
@@ -141,36 +664,143 @@ class HelloTriangleApplication {
     uint32_t semaphoreIndex = 0;
     bool framebufferResized = false;
 
-    vk::raii::Buffer vertexBuffer = nullptr;
-    vk::raii::DeviceMemory vertexBufferMemory = nullptr;
-    vk::raii::Buffer indexBuffer = nullptr;
-    vk::raii::DeviceMemory indexBufferMemory = nullptr;
+    uint64_t frameNumber = 0;
+    std::chrono::steady_clock::time_point animationStartTime;
+    FrameStats frameStats;
+    GpuProfiler gpuProfiler;
+
+    // What frames draw: the placeholders until the assets are resident
+    GpuMesh mesh;
+    Texture texture;
+
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    // The mesh as uploaded: views of the mapped mesh cache, or of vertices and
+    // indices when the cache had to be rebuilt.
+    MeshCache meshCache;
+    std::span<const Vertex> meshVertices;
+    std::span<const uint32_t> meshIndices;
+    std::vector<Meshlet> meshlets;
+    std::span<const Meshlet> meshMeshlets;
+    std::vector<MeshLod> lods;
+    std::span<const MeshLod> meshLods;
+    // Layout of the uploaded mesh, chosen by chooseVertexLayout()
+    bool usePackedVertices = false;
+    glm::vec3 meshBoundsMin{0.0f};
+    glm::vec3 meshBoundsExtent{1.0f};
+    glm::mat4 meshDequantize{1.0f};
+    vk::IndexType indexType = vk::IndexType::eUint32;
+
+    // Assets load in the background while frames draw the placeholders. The
+    // mesh members above belong to the loader until modelLoad is ready, which
+    // is why the futures come after them: destroying a future from
+    // std::async waits for its thread.
+    enum class AssetState { Loading, Uploading, Resident };
+    AssetState assetState = AssetState::Loading;
+    std::future<void> modelLoad;
+    std::future<TextureSource> textureLoad;
+    GpuMesh loadedMesh;
+    Texture loadedTexture;
+    uint64_t assetUploadValue = 0;
+    // Swapped out resources, kept until every frame that used them is done
+    struct RetiredAssets {
+      uint64_t frame;
+      GpuMesh mesh;
+      Texture texture;
+    };
+    std::deque<RetiredAssets> retiredAssets;
+    std::chrono::steady_clock::time_point launchTime;
+    bool firstFrameReported = false;
 
     std::vector<vk::raii::Buffer> uniformBuffers;
-    std::vector<vk::raii::DeviceMemory> uniformBuffersMemory;
+    std::vector<Allocation> uniformBufferAllocations;
     std::vector<void *> uniformBuffersMapped;
 
+    // Per frame slot, the transform of every instance. The transforms only
+    // change with instanceCount, so a slot's buffer is rewritten when its
+    // generation lags behind instanceGeneration.
+    std::vector<vk::raii::Buffer> instanceBuffers;
+    std::vector<Allocation> instanceBufferAllocations;
+    uint32_t instanceCapacity = 0;
+    uint32_t instanceCount = 1;
+    uint32_t instanceGeneration = 1;
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> instanceBufferGeneration{};
+    // Level of detail of the frame's direct draws, of mesh.lods
+    uint32_t directLod = 0;
+    // What updateUniformBuffer() chose levels of detail by this frame: the
+    // eye, how far an instance's bounding sphere reaches from its position,
+    // and the levels and distance scale the uniform buffer holds
+    glm::vec3 lodEye{0.0f};
+    float lodReach = 0.0f;
+    uint32_t lodCount = 1;
+    float lodScale = 0.0f;
+
+    // GPU culling: per frame slot, the indirect draws of the visible
+    // instances and the CullStats counters, both written by the cull pass,
+    // and a host copy of the counters read once the slot's fence signals
+    vk::raii::DescriptorSetLayout cullSetLayout = nullptr;
+    vk::raii::PipelineLayout cullPipelineLayout = nullptr;
+    vk::raii::Pipeline cullPipeline = nullptr;
+    vk::raii::DescriptorPool cullDescriptorPool = nullptr;
+    std::vector<vk::raii::DescriptorSet> cullDescriptorSets;
+    std::vector<vk::raii::Buffer> drawCommandBuffers;
+    std::vector<Allocation> drawCommandBufferAllocations;
+    std::vector<vk::raii::Buffer> cullCounterBuffers;
+    std::vector<Allocation> cullCounterBufferAllocations;
+    std::vector<vk::raii::Buffer> cullStatsBuffers;
+    std::vector<Allocation> cullStatsBufferAllocations;
+    // Draws each phase's list of a draw command buffer has room for, one
+    // per level of detail
+    uint32_t drawCapacity = 0;
+    // Per frame slot, the instances each draw draws, in lists of
+    // instanceCapacity, the early or only phase's first
+    std::vector<vk::raii::Buffer> visibleInstanceBuffers;
+    std::vector<Allocation> visibleInstanceBufferAllocations;
+    // Draws, each with its list, a slot's buffers have room for. Meshlet
+    // culling grows them to a draw per meshlet.
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> cullDrawLists{};
+    // Instances, or meshlets of all instances, tested by the frame in each
+    // slot whose counters are yet to be read, 0 when there is none
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> cullStatsTested{};
+    CullStats cullStats{};
+    // Meshlet culling: the meshlet buffer each slot's cull set points at,
+    // rewritten before the slot culls a different mesh
+    std::array<vk::Buffer, MAX_FRAMES_IN_FLIGHT> cullSetMeshlets{};
+
+    // Occlusion culling: which instances the last late phase found visible,
+    // shared by all frames, and the depth pyramid of the frame being drawn
+    vk::raii::Buffer visibilityBuffer = nullptr;
+    Allocation visibilityBufferAllocation = nullptr;
+    vk::raii::DescriptorSetLayout pyramidSetLayout = nullptr;
+    vk::raii::PipelineLayout pyramidPipelineLayout = nullptr;
+    vk::raii::Pipeline pyramidDepthPipeline = nullptr;
+    vk::raii::Pipeline pyramidReducePipeline = nullptr;
+    vk::raii::DescriptorPool pyramidDescriptorPool = nullptr;
+    vk::raii::Image depthPyramid = nullptr;
+    Allocation depthPyramidAllocation = nullptr;
+    vk::raii::ImageView depthPyramidView = nullptr;
+    std::vector<vk::raii::ImageView> depthPyramidLevelViews;
+    // Per level, what it is reduced from and the level itself
+    std::vector<vk::raii::DescriptorSet> depthPyramidSets;
+    uint32_t pyramidWidth = 0;
+    uint32_t pyramidHeight = 0;
+    uint32_t pyramidLevels = 0;
+
     vk::raii::DescriptorPool descriptorPool = nullptr;
     std::vector<vk::raii::DescriptorSet> descriptorSets;
 
-    vk::raii::Image textureImage = nullptr;
-    vk::raii::DeviceMemory textureImageMemory = nullptr;
-
-    vk::raii::ImageView textureImageView = nullptr;
     vk::raii::Sampler textureSampler = nullptr;
+    // Set 1: every texture a draw may sample, by Texture::tableSlot
+    TextureTable textureTable;
 
     vk::raii::Image depthImage = nullptr;
-    vk::raii::DeviceMemory depthImageMemory = nullptr;
+    Allocation depthImageAllocation = nullptr;
     vk::raii::ImageView depthImageView = nullptr;
 
-    uint32_t mipLevels = 1;
-
     vk::SampleCountFlagBits msaaSamples = vk::SampleCountFlagBits::e1;
 
 	vk::raii::Image colorImage = nullptr;
-    vk::raii::DeviceMemory colorImageMemory = nullptr;
+    Allocation colorImageAllocation = nullptr;
 	vk::raii::ImageView colorImageView = nullptr;
 
 
@@ -188,27 +818,70 @@ class HelloTriangleApplication {
     void initVulkan() {
         createInstance();
         setupDebugMessenger();
-        createSurface();
+        if (!options.headless) {
+            createSurface();
+        }
         pickPhysicalDevice();
         createLogicalDevice();
-        createSwapChain();
+        if (options.headless) {
+            createOffscreenTargets();
+        } else {
+            createSwapChain();
+        }
         createImageViews();
         createDescriptorSetLayout();
+        textureTable.init(device, physicalDevice);
+        pipelineCache.init(device, physicalDevice,
+                           options.pipelineCache ? PIPELINE_CACHE_PATH : "");
         createGraphicsPipeline();
         createCommandPool();
+        uploads.init(device, allocator, transferQueue, transferIndex,
+                     graphicsQueue, graphicsIndex);
         createColorResources();
         createDepthResource();
-        createTextureImage();
-        createTextureImageView();
         createTextureSampler();
-        loadModel();
-        createVertexBuffer();
-        createIndexBuffer();
+        createMipDownsampler();
+        createPlaceholderAssets();
         createUniformBuffers();
+        createInstanceBuffers();
         createDescriptorPool();
         createDescriptorSets();
+        if (options.gpuCulling) {
+            createCullPass();
+        }
         createCommandBuffers();
         createSyncObjects();
+        if (options.gpuProfile) {
+            // Secondaries can only run inside the statistics query where
+            // queries are inherited
+            gpuProfiler.init(device, physicalDevice, graphicsIndex,
+                             MAX_FRAMES_IN_FLIGHT,
+                             options.recordThreads == 0 ||
+                               physicalDevice.getFeatures().inheritedQueries);
+        }
+        savePipelineCache();
+        if (options.memoryStats) {
+            allocator.printStats(std::cout);
+        }
+    }
+
+    // Reports how pipeline creation went and saves what the driver added to
+    // the cache. Every pipeline is built by now.
+    void savePipelineCache() {
+        std::cout << "Pipeline cache "
+                  << (pipelineCache.loaded() ? "hit" : "miss") << " ("
+                  << pipelineCache.loadedBytes() << " bytes loaded): "
+                  << pipelineCache.pipelines() << " pipelines in "
+                  << pipelineCache.milliseconds() << " ms";
+        if (pipelineCache.reported() > 0) {
+            std::cout << ", " << pipelineCache.hits() << " of "
+                      << pipelineCache.reported() << " found in the cache";
+        }
+        std::cout << std::endl;
+        if (options.pipelineCache && !pipelineCache.save()) {
+            std::cerr << "failed to write " << PIPELINE_CACHE_PATH
+                      << std::endl;
+        }
     }
 
     void createSwapChain() {
@@ -253,6 +926,35 @@ class HelloTriangleApplication {
             imagesInFlight.assign(swapChainImages.size(), vk::Fence{});
     }
 
+    // Stand-in for the swapchain when running headless: one color target per
+    // frame in flight, so an image is never reused while a frame renders to it.
+    void createOffscreenTargets() {
+        swapChainExtent = vk::Extent2D{WIDTH, HEIGHT};
+        swapChainImageFormat = findSupportedFormat(
+            {vk::Format::eB8G8R8A8Srgb, vk::Format::eR8G8B8A8Srgb},
+            vk::ImageTiling::eOptimal,
+            vk::FormatFeatureFlagBits::eColorAttachment);
+
+        offscreenImages.clear();
+        offscreenImageAllocations.clear();
+        swapChainImages.clear();
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vk::raii::Image image({});
+            Allocation imageAllocation;
+            createImage(swapChainExtent.width, swapChainExtent.height, 1,
+                        vk::SampleCountFlagBits::e1, swapChainImageFormat,
+                        vk::ImageTiling::eOptimal,
+                        vk::ImageUsageFlagBits::eColorAttachment |
+                            vk::ImageUsageFlagBits::eTransferSrc,
+                        vk::MemoryPropertyFlagBits::eDeviceLocal, image,
+                        imageAllocation);
+            swapChainImages.push_back(*image);
+            offscreenImages.emplace_back(std::move(image));
+            offscreenImageAllocations.emplace_back(std::move(imageAllocation));
+        }
+        imagesInFlight.assign(swapChainImages.size(), vk::Fence{});
+    }
+
     vk::SurfaceFormatKHR chooseSwapSurfaceFormat(
       const std::vector<vk::SurfaceFormatKHR> &availableFormats) {
       for (const auto &availableFormat : availableFormats) {
@@ -292,11 +994,6 @@ class HelloTriangleApplication {
       std::vector<vk::QueueFamilyProperties> queueFamilyProperties =
         physicalDevice.getQueueFamilyProperties();
 
-      std::vector<vk::SurfaceFormatKHR> availableFormats =
-        physicalDevice.getSurfaceFormatsKHR(surface);
-      std::vector<vk::PresentModeKHR> availablePresentModes =
-        physicalDevice.getSurfacePresentModesKHR(surface);
-
       auto graphicsQueueFamilyProperty =
         std::ranges::find_if(queueFamilyProperties, [](auto const &qfp) {
           return (qfp.queueFlags & vk::QueueFlagBits::eGraphics) !=
@@ -306,8 +1003,10 @@ class HelloTriangleApplication {
       graphicsIndex = static_cast<uint32_t>(std::distance(
         queueFamilyProperties.begin(), graphicsQueueFamilyProperty));
 
+      // Without a surface nothing is presented, the graphics queue stands in
       auto presentIndex =
-        physicalDevice.getSurfaceSupportKHR(graphicsIndex, *surface)
+        options.headless ||
+            physicalDevice.getSurfaceSupportKHR(graphicsIndex, *surface)
           ? graphicsIndex
           : static_cast<uint32_t>(queueFamilyProperties.size());
 
@@ -339,33 +1038,68 @@ class HelloTriangleApplication {
       }
 
       auto features = physicalDevice.getFeatures2();
+      vk::PhysicalDeviceVulkan12Features vulkan12Features{};
+      vulkan12Features.timelineSemaphore = vk::True;
+      // TextureTable
+      vulkan12Features.runtimeDescriptorArray = vk::True;
+      vulkan12Features.descriptorBindingPartiallyBound = vk::True;
+      vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = vk::True;
+      vulkan12Features.descriptorBindingUpdateUnusedWhilePending = vk::True;
+      // Depth-only layouts
+      vulkan12Features.separateDepthStencilLayouts = vk::True;
       vk::PhysicalDeviceVulkan13Features vulkan13Features{};
+      vulkan13Features.pNext = &vulkan12Features;
       vulkan13Features.dynamicRendering = vk::True;
       vulkan13Features.synchronization2 = vk::True;
       features.pNext = &vulkan13Features;
 
+      // A family with transfer but neither graphics nor compute is usually a
+      // DMA engine that copies while the graphics queue renders
+      transferIndex = graphicsIndex;
+      for (size_t i = 0; i < queueFamilyProperties.size(); i++) {
+        vk::QueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) &&
+            !(flags & (vk::QueueFlagBits::eGraphics |
+                       vk::QueueFlagBits::eCompute))) {
+          transferIndex = static_cast<uint32_t>(i);
+          break;
+        }
+      }
+
       float queuePriority = 0.0f;
-      vk::DeviceQueueCreateInfo deviceQueueCreateInfo{
-        .queueFamilyIndex = graphicsIndex,
-        .queueCount = 1,
-        .pQueuePriorities = &queuePriority};
-
-      vk::DeviceCreateInfo deviceCreateInfo{.pNext = &features,
-                                            .queueCreateInfoCount = 1,
-                                            .pQueueCreateInfos =
-                                              &deviceQueueCreateInfo};
-      deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
-      deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+      std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos{
+        {.queueFamilyIndex = graphicsIndex,
+         .queueCount = 1,
+         .pQueuePriorities = &queuePriority}};
+      if (transferIndex != graphicsIndex) {
+        deviceQueueCreateInfos.push_back({.queueFamilyIndex = transferIndex,
+                                          .queueCount = 1,
+                                          .pQueuePriorities = &queuePriority});
+      }
+
+      vk::DeviceCreateInfo deviceCreateInfo{
+        .pNext = &features,
+        .queueCreateInfoCount =
+          static_cast<uint32_t>(deviceQueueCreateInfos.size()),
+        .pQueueCreateInfos = deviceQueueCreateInfos.data()};
+      auto requiredDeviceExtensions = getRequiredDeviceExtensions();
+      deviceCreateInfo.enabledExtensionCount =
+        static_cast<uint32_t>(requiredDeviceExtensions.size());
+      deviceCreateInfo.ppEnabledExtensionNames =
+        requiredDeviceExtensions.data();
 
       device = vk::raii::Device(physicalDevice, deviceCreateInfo);
 
       graphicsQueue = vk::raii::Queue(device, graphicsIndex, 0);
       presentQueue = vk::raii::Queue(device, presentIndex, 0);
+      transferQueue = vk::raii::Queue(device, transferIndex, 0);
+      allocator.init(device, physicalDevice);
     }
 
 	void pickPhysicalDevice() {
       std::vector<vk::raii::PhysicalDevice> devices =
         instance.enumeratePhysicalDevices();
+      auto requiredDeviceExtensions = getRequiredDeviceExtensions();
       const auto devIter =
         std::ranges::find_if(devices, [&](auto const &device) {
           auto queueFamilies = device.getQueueFamilyProperties();
@@ -379,7 +1113,7 @@ class HelloTriangleApplication {
           isSuitable = isSuitable && (qfpIter != queueFamilies.end());
           auto extensions = device.enumerateDeviceExtensionProperties();
           bool found = true;
-          for (auto const &extension : deviceExtensions) {
+          for (auto const &extension : requiredDeviceExtensions) {
             auto extensionIter =
               std::ranges::find_if(extensions, [extension](auto const &ext) {
                 return strcmp(ext.extensionName, extension) == 0;
@@ -387,14 +1121,22 @@ class HelloTriangleApplication {
             found = found && extensionIter != extensions.end();
           }
           auto features = device.template getFeatures2<
-            vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features,
+            vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features,
+            vk::PhysicalDeviceVulkan13Features,
             vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>();
+          const auto &vulkan12Features =
+            features.template get<vk::PhysicalDeviceVulkan12Features>();
 
           bool supportsRequiredFeatures =
             features.template get<vk::PhysicalDeviceFeatures2>()
               .features.samplerAnisotropy &&
             features.template get<vk::PhysicalDeviceVulkan13Features>()
               .dynamicRendering &&
+            vulkan12Features.runtimeDescriptorArray &&
+            vulkan12Features.descriptorBindingPartiallyBound &&
+            vulkan12Features.descriptorBindingSampledImageUpdateAfterBind &&
+            vulkan12Features.descriptorBindingUpdateUnusedWhilePending &&
+            vulkan12Features.separateDepthStencilLayouts &&
             features
               .template get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>()
               .extendedDynamicState;
@@ -488,32 +1230,154 @@ class HelloTriangleApplication {
     }
 
 	std::vector<const char *> getRequiredExtensions() {
-      uint32_t glfwExtensionCount = 0;
-      auto glfwExtensions =
-        glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-      std::vector extensions(glfwExtensions,
-                             glfwExtensions + glfwExtensionCount);
+      std::vector<const char *> extensions;
+      if (!options.headless) {
+        uint32_t glfwExtensionCount = 0;
+        auto glfwExtensions =
+          glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions,
+                          glfwExtensions + glfwExtensionCount);
+      }
       if (enableValidationLayers) {
         extensions.push_back(vk::EXTDebugUtilsExtensionName);
       }
 
+      return extensions;
+    }
+
+	std::vector<const char *> getRequiredDeviceExtensions() const {
+      std::vector<const char *> extensions;
+      for (const char *extension : deviceExtensions) {
+        // No swapchain is created when running headless
+        if (options.headless &&
+            strcmp(extension, vk::KHRSwapchainExtensionName) == 0) {
+          continue;
+        }
+        extensions.push_back(extension);
+      }
       return extensions;
     }
 
 	void mainLoop() {
-      while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+      uint32_t frameLimit = options.frameCount;
+      if (options.benchmarkFrames > 0) {
+        frameLimit = BENCHMARK_WARMUP_FRAMES + options.benchmarkFrames;
+      } else if (options.headless && frameLimit == 0) {
+        frameLimit = DEFAULT_HEADLESS_FRAMES;
+      }
+      // Measured frames have to show the real scene
+      if (options.benchmarkFrames > 0) {
+        waitForAssets();
+      }
+
+      auto startTime = std::chrono::steady_clock::now();
+      animationStartTime = startTime;
+      uint32_t framesRendered = 0;
+      while (frameLimit == 0 || framesRendered < frameLimit) {
+        if (!options.headless) {
+          if (glfwWindowShouldClose(window)) {
+            break;
+          }
+          glfwPollEvents();
+        }
+        frameStats.setRecording(options.benchmarkFrames > 0 &&
+                                framesRendered >= BENCHMARK_WARMUP_FRAMES);
         drawFrame();
+        framesRendered++;
+        if (!firstFrameReported && frameNumber > 0) {
+          firstFrameReported = true;
+          std::cout << "Time to first frame: " << millisecondsSinceLaunch()
+                    << " ms" << std::endl;
+        }
       }
 
       device.waitIdle();
+
+      if (options.benchmarkFrames > 0) {
+        reportBenchmark();
+      }
+
+      double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - startTime)
+                         .count();
+      if (options.headless && seconds > 0.0) {
+        std::cout << "Rendered " << framesRendered << " frames in "
+                  << seconds << " s (" << framesRendered / seconds
+                  << " frames/s)" << std::endl;
+      }
+    }
+
+	// Renders BENCHMARK_WARMUP_FRAMES and then options.benchmarkFrames
+	// measured frames at each of INSTANCE_SWEEP. CPU time is the frame
+	// without waiting for fences, acquire and present, which mostly measure
+	// the GPU.
+	void runInstanceSweep() {
+	  waitForAssets();
+	  animationStartTime = std::chrono::steady_clock::now();
+	  for (uint32_t count : INSTANCE_SWEEP) {
+		setInstanceCount(count);
+		frameStats = FrameStats{};
+		uint32_t frameLimit = BENCHMARK_WARMUP_FRAMES + options.benchmarkFrames;
+		for (uint32_t frame = 0; frame < frameLimit; frame++) {
+		  if (!options.headless) {
+			if (glfwWindowShouldClose(window)) {
+			  device.waitIdle();
+			  return;
+			}
+			glfwPollEvents();
+		  }
+		  frameStats.setRecording(frame >= BENCHMARK_WARMUP_FRAMES);
+		  drawFrame();
+		}
+		device.waitIdle();
+
+		auto summary = frameStats.summarize();
+		double cpuMs = summary["update_uniforms"].p50 + summary["record"].p50 +
+					   summary["submit"].p50;
+		std::cout << count << " instances (camera and far plane scaled by "
+				  << viewScale() << " to fit the grid): frame p50 "
+				  << summary["frame"].p50
+				  << " ms, CPU p50 " << cpuMs << " ms, GPU p50 "
+				  << summary["gpu_frame"].p50 << " ms, GPU p95 "
+				  << summary["gpu_frame"].p95 << " ms";
+		if (options.gpuCulling) {
+		  std::cout << ", " << cullStats.earlyDraws + cullStats.lateDraws
+					<< " drawn in the last frame read back";
+		}
+		std::cout << std::endl;
+	  }
+	}
+
+	void reportBenchmark() {
+      std::string report = frameStats.toJson();
+      if (options.benchmarkOutput.empty()) {
+        std::cout << report;
+      } else {
+        std::ofstream file(options.benchmarkOutput);
+        if (!file.is_open()) {
+          throw std::runtime_error("failed to open benchmark output file!");
+        }
+        file << report;
+      }
+
+      if (options.benchmarkBaseline.empty()) {
+        return;
+      }
+      std::vector<char> baseline = readFile(options.benchmarkBaseline);
+      bool withinTolerance = FrameStats::compare(
+        FrameStats::parseJson(std::string(baseline.begin(), baseline.end())),
+        frameStats.summarize(), options.benchmarkTolerance, std::cout);
+      if (!withinTolerance) {
+        throw std::runtime_error("benchmark regressed against baseline!");
+      }
     }
 
 	void cleanup() {
       cleanupSwapChain();
-      glfwDestroyWindow(window);
-      glfwTerminate();
+      if (!options.headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+      }
     }
 
 	void createSurface() {
@@ -536,14 +1400,26 @@ class HelloTriangleApplication {
     }
 
 	void createDescriptorSetLayout() {
+      // Textures are in set 1, see TextureTable
       std::array bindings = {vk::DescriptorSetLayoutBinding(
                                0, vk::DescriptorType::eUniformBuffer, 1,
                                vk::ShaderStageFlagBits::eVertex, nullptr),
                              vk::DescriptorSetLayoutBinding(
-                               1, vk::DescriptorType::eCombinedImageSampler, 1,
-                               vk::ShaderStageFlagBits::eFragment, nullptr)};
+                               1, vk::DescriptorType::eStorageBuffer, 1,
+                               vk::ShaderStageFlagBits::eVertex, nullptr),
+                             vk::DescriptorSetLayoutBinding(
+                               2, vk::DescriptorType::eStorageBuffer, 1,
+                               vk::ShaderStageFlagBits::eVertex, nullptr)};
+      // The visible instances are only written with GPU culling, whose draws
+      // are the only ones to read them
+      std::vector<vk::DescriptorBindingFlags> bindingFlags(bindings.size());
+      bindingFlags[2] = vk::DescriptorBindingFlagBits::ePartiallyBound;
+      vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{
+        .bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+        .pBindingFlags = bindingFlags.data()};
 
       vk::DescriptorSetLayoutCreateInfo layoutInfo{
+        .pNext = &bindingFlagsInfo,
         .bindingCount = static_cast<uint32_t>(bindings.size()),
         .pBindings = bindings.data()};
       descriptorSetLayout = vk::raii::DescriptorSetLayout(device, layoutInfo);
@@ -553,26 +1429,6 @@ class HelloTriangleApplication {
       vk::raii::ShaderModule shaderModule =
         createShaderModule(readFile("shaders/slang_shaders.spv"));
 
-      vk::PipelineShaderStageCreateInfo vertShaderStageInfo{
-        .stage = vk::ShaderStageFlagBits::eVertex,
-        .module = shaderModule,
-        .pName = "vertMain"};
-      vk::PipelineShaderStageCreateInfo fragShaderStageInfo{
-        .stage = vk::ShaderStageFlagBits::eFragment,
-        .module = shaderModule,
-        .pName = "fragMain"};
-
-      vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                          fragShaderStageInfo};
-
-      auto bindingDescription = Vertex::getBindingDescription();
-      auto attributeDescriptions = Vertex::getAttributeDescriptions();
-      vk::PipelineVertexInputStateCreateInfo vertexInputInfo{
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDescription,
-        .vertexAttributeDescriptionCount = attributeDescriptions.size(),
-        .pVertexAttributeDescriptions = attributeDescriptions.data()};
-
       vk::PipelineInputAssemblyStateCreateInfo inputAssembly{
         .topology = vk::PrimitiveTopology::eTriangleList};
 
@@ -618,10 +1474,17 @@ class HelloTriangleApplication {
         .dynamicStateCount = static_cast<uint32_t>(dynamicStates.size()),
         .pDynamicStates = dynamicStates.data()};
 
+      std::array setLayouts = {*descriptorSetLayout, *textureTable.layout()};
+      vk::PushConstantRange pushConstantRange{
+        .stageFlags = vk::ShaderStageFlagBits::eVertex |
+                      vk::ShaderStageFlagBits::eFragment,
+        .offset = 0,
+        .size = sizeof(DrawConstants)};
       vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
-        .setLayoutCount = 1,
-        .pSetLayouts = &*descriptorSetLayout,
-        .pushConstantRangeCount = 0};
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange};
       pipelineLayout = vk::raii::PipelineLayout(device, pipelineLayoutInfo);
 
       vk::Format depthFormat = findDepthFormat();
@@ -631,22 +1494,62 @@ class HelloTriangleApplication {
         .pColorAttachmentFormats = &swapChainImageFormat,
         .depthAttachmentFormat = depthFormat};
 
-      vk::GraphicsPipelineCreateInfo pipelineInfo{
-        .pNext = &pipelineRenderingCreateInfo,
-        .stageCount = 2,
-        .pStages = shaderStages,
-        .pVertexInputState = &vertexInputInfo,
-        .pInputAssemblyState = &inputAssembly,
-        .pViewportState = &viewportState,
-        .pRasterizationState = &rasterizer,
-        .pMultisampleState = &multisampling,
-        .pDepthStencilState = &depthStencil,
-        .pColorBlendState = &colorBlending,
-        .pDynamicState = &dynamicState,
-        .layout = pipelineLayout,
-        .renderPass = nullptr};
-
-      graphicsPipeline = vk::raii::Pipeline(device, nullptr, pipelineInfo);
+      // The placeholder mesh always uses Vertex, so the packed variant is
+      // built up front too, before the loader has picked a layout
+      auto buildPipeline = [&](bool packed) {
+        vk::PipelineShaderStageCreateInfo vertShaderStageInfo{
+          .stage = vk::ShaderStageFlagBits::eVertex,
+          .module = shaderModule,
+          .pName = packed ? "vertMainPacked" : "vertMain"};
+        vk::PipelineShaderStageCreateInfo fragShaderStageInfo{
+          .stage = vk::ShaderStageFlagBits::eFragment,
+          .module = shaderModule,
+          .pName = "fragMain"};
+
+        vk::PipelineShaderStageCreateInfo shaderStages[] = {
+          vertShaderStageInfo, fragShaderStageInfo};
+
+        auto bindingDescription = packed
+                                    ? PackedVertex::getBindingDescription()
+                                    : Vertex::getBindingDescription();
+        std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
+        if (packed) {
+          auto packedAttributes = PackedVertex::getAttributeDescriptions();
+          attributeDescriptions.assign(packedAttributes.begin(),
+                                       packedAttributes.end());
+        } else {
+          auto full = Vertex::getAttributeDescriptions();
+          attributeDescriptions.assign(full.begin(), full.end());
+        }
+        vk::PipelineVertexInputStateCreateInfo vertexInputInfo{
+          .vertexBindingDescriptionCount = 1,
+          .pVertexBindingDescriptions = &bindingDescription,
+          .vertexAttributeDescriptionCount =
+            static_cast<uint32_t>(attributeDescriptions.size()),
+          .pVertexAttributeDescriptions = attributeDescriptions.data()};
+
+        vk::GraphicsPipelineCreateInfo pipelineInfo{
+          .pNext = &pipelineRenderingCreateInfo,
+          .stageCount = 2,
+          .pStages = shaderStages,
+          .pVertexInputState = &vertexInputInfo,
+          .pInputAssemblyState = &inputAssembly,
+          .pViewportState = &viewportState,
+          .pRasterizationState = &rasterizer,
+          .pMultisampleState = &multisampling,
+          .pDepthStencilState = &depthStencil,
+          .pColorBlendState = &colorBlending,
+          .pDynamicState = &dynamicState,
+          .layout = pipelineLayout,
+          .renderPass = nullptr};
+
+        return pipelineCache.build(pipelineInfo);
+      };
+
+      graphicsPipeline = buildPipeline(false);
+      if (options.packedVertices) {
+        packedGraphicsPipeline = buildPipeline(true);
+      }
     }
 
 	void createCommandPool() {
@@ -696,7 +1599,7 @@ class HelloTriangleApplication {
 				  vk::ImageUsageFlagBits::eTransientAttachment |
 					vk::ImageUsageFlagBits::eColorAttachment,
 				  vk::MemoryPropertyFlagBits::eDeviceLocal, colorImage,
-				  colorImageMemory);
+				  colorImageAllocation);
 	  colorImageView = createImageView(colorImage, colorFormat,
 									   vk::ImageAspectFlagBits::eColor, 1);
 	}
@@ -706,78 +1609,371 @@ class HelloTriangleApplication {
 	  createImage(swapChainExtent.width, swapChainExtent.height, 1,
 				  msaaSamples, depthFormat,
 				  vk::ImageTiling::eOptimal,
-				  vk::ImageUsageFlagBits::eDepthStencilAttachment,
+				  options.occlusionCulling
+					? vk::ImageUsageFlagBits::eDepthStencilAttachment |
+						vk::ImageUsageFlagBits::eSampled
+					: vk::ImageUsageFlagBits::eDepthStencilAttachment,
 				  vk::MemoryPropertyFlagBits::eDeviceLocal, depthImage,
-				  depthImageMemory);
+				  depthImageAllocation);
       depthImageView = createImageView(depthImage, depthFormat,
                                        vk::ImageAspectFlagBits::eDepth, 1);
     }
 
-	void createTextureImage() { 
-				int texWidth, texHeight, texChannels;
-          stbi_uc *pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth,
-                                      &texHeight, &texChannels, STBI_rgb_alpha);
-          vk::DeviceSize imageSize = texWidth * texHeight * 4;
+	bool supportsLinearBlit(vk::Format format) const {
+	  return static_cast<bool>(
+		physicalDevice.getFormatProperties(format).optimalTilingFeatures &
+		vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+	}
 
-          if (!pixels) {
-            throw std::runtime_error("failed to load texture image!");
-          }
+	// Records the upload of RGBA8 pixels into a new mipmapped texture. The
+	// CPU path writes the whole chain straight into staging memory and needs
+	// nothing from the graphics queue but the ownership acquire.
+	Texture createTexture(const void *pixels, uint32_t texWidth,
+						  uint32_t texHeight, MipMode mode) {
+	  Texture result;
+	  result.mipLevels = mipLevelCount(texWidth, texHeight);
+
+	  // A single level is a plain copy, and one dispatch only covers
+	  // DOWNSAMPLE_MAX_LEVELS
+	  if (result.mipLevels == 1) {
+		mode = MipMode::Cpu;
+	  } else if (mode == MipMode::Compute &&
+				 result.mipLevels > DOWNSAMPLE_MAX_LEVELS) {
+		mode = MipMode::Auto;
+	  }
+	  bool linearBlit = supportsLinearBlit(vk::Format::eR8G8B8A8Srgb);
+	  if (mode == MipMode::Blit && !linearBlit) {
+		throw std::runtime_error(
+		  "texture image format does not support linear blitting!");
+	  }
+	  if (mode == MipMode::Auto) {
+		mode = linearBlit ? MipMode::Blit : MipMode::Cpu;
+	  }
 
-          mipLevels = static_cast<uint32_t>(
-                        std::floor(std::log2(std::max(texWidth, texHeight)))) +
-                      1;
-
-          vk::raii::Buffer stagingBuffer({});
-          vk::raii::DeviceMemory stagingBufferMemory({});
-
-          createBuffer(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-                       vk::MemoryPropertyFlagBits::eHostVisible |
-                         vk::MemoryPropertyFlagBits::eHostCoherent,
-                       stagingBuffer, stagingBufferMemory);
-
-          void *data = stagingBufferMemory.mapMemory(0, imageSize);
-          memcpy(data, pixels, imageSize);
-          stagingBufferMemory.unmapMemory();
-
-          // clean up original image array after copy
-          stbi_image_free(pixels);
-
-          vk::raii::Image textureImageTemp({});
-          vk::raii::DeviceMemory textureImageMemmoryTemp({});
-          createImage(texWidth, texHeight, mipLevels,
-                      vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Srgb,
-                      vk::ImageTiling::eOptimal,
-                      vk::ImageUsageFlagBits::eTransferSrc |
-                        vk::ImageUsageFlagBits::eTransferDst |
-                        vk::ImageUsageFlagBits::eSampled,
-                      vk::MemoryPropertyFlagBits::eDeviceLocal,
-                      textureImageTemp, textureImageMemmoryTemp);
-
-          textureImage = std::move(textureImageTemp);
-          textureImageMemory = std::move(textureImageMemmoryTemp);
-
-          transitionImageLayout(textureImage, vk::ImageLayout::eUndefined,
-                                vk::ImageLayout::eTransferDstOptimal,
-                                mipLevels);
-          copyBufferToImage(stagingBuffer, textureImage,
-                            static_cast<uint32_t>(texWidth),
-                            static_cast<uint32_t>(texHeight));
-          generateMipmaps(textureImage, vk::Format::eR8G8B8A8Srgb, texWidth,
-                          texHeight, mipLevels);
-        }
+	  vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferDst |
+								  vk::ImageUsageFlagBits::eSampled;
+	  vk::ImageCreateFlags flags;
+	  if (mode == MipMode::Blit) {
+		usage |= vk::ImageUsageFlagBits::eTransferSrc;
+	  } else if (mode == MipMode::Compute) {
+		// Written through UNORM views, which can be storage images
+		usage |= vk::ImageUsageFlagBits::eStorage;
+		flags = vk::ImageCreateFlagBits::eMutableFormat |
+				vk::ImageCreateFlagBits::eExtendedUsage;
+	  }
+	  createImage(texWidth, texHeight, result.mipLevels,
+				  vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Srgb,
+				  vk::ImageTiling::eOptimal, usage,
+				  vk::MemoryPropertyFlagBits::eDeviceLocal, result.image,
+				  result.allocation, flags);
+
+	  transitionImageLayout(result.image, vk::ImageLayout::eUndefined,
+							vk::ImageLayout::eTransferDstOptimal,
+							result.mipLevels);
+
+	  if (mode == MipMode::Cpu) {
+		MipChainLayout layout = mipChainLayout(texWidth, texHeight);
+		StagingSpan staging = uploads.stage(layout.totalSize);
+		generateMipChain(static_cast<const uint8_t *>(pixels), layout,
+						 static_cast<uint8_t *>(staging.data), &workerPool);
+		std::vector<vk::BufferImageCopy> regions;
+		for (uint32_t level = 0; level < result.mipLevels; level++) {
+		  const MipLevelLayout &entry = layout.levels[level];
+		  regions.push_back(vk::BufferImageCopy(
+			staging.offset + entry.offset, 0, 0,
+			{vk::ImageAspectFlagBits::eColor, level, 0, 1}, {0, 0, 0},
+			{entry.width, entry.height, 1}));
+		}
+		copyMipLevels(staging, result, regions);
+	  } else {
+		vk::DeviceSize imageSize = vk::DeviceSize(texWidth) * texHeight * 4;
+		StagingSpan staging = uploads.stage(imageSize);
+		memcpy(staging.data, pixels, imageSize);
+
+		copyBufferToImage(staging, result.image, texWidth, texHeight);
+		// The mip blits and dispatch need the graphics queue
+		vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0,
+										result.mipLevels, 0, 1};
+		if (mode == MipMode::Blit) {
+		  uploads.handOff(*result.image, range,
+						  vk::ImageLayout::eTransferDstOptimal,
+						  vk::ImageLayout::eTransferDstOptimal,
+						  vk::PipelineStageFlagBits2::eTransfer,
+						  vk::AccessFlagBits2::eTransferRead |
+							vk::AccessFlagBits2::eTransferWrite);
+		  generateMipmaps(result.image, static_cast<int32_t>(texWidth),
+						  static_cast<int32_t>(texHeight), result.mipLevels);
+		} else {
+		  uploads.handOff(*result.image, range,
+						  vk::ImageLayout::eTransferDstOptimal,
+						  vk::ImageLayout::eGeneral,
+						  vk::PipelineStageFlagBits2::eComputeShader,
+						  vk::AccessFlagBits2::eShaderStorageRead |
+							vk::AccessFlagBits2::eShaderStorageWrite);
+		  generateMipmapsCompute(result, texWidth, texHeight);
+		}
+	  }
 
-	void generateMipmaps(const vk::raii::Image& image, vk::Format imageFormat, int32_t texWidth,
-						 int32_t texHeight, uint32_t mipLevels) {
-	  vk::FormatProperties formatProperties =
-		physicalDevice.getFormatProperties(imageFormat);
+	  result.view = createImageView(result.image, vk::Format::eR8G8B8A8Srgb,
+									vk::ImageAspectFlagBits::eColor,
+									result.mipLevels);
+	  return result;
+	}
 
-	  if (!(formatProperties.optimalTilingFeatures &
-			vk::FormatFeatureFlagBits::eSampledImageFilterLinear)) {
-		throw std::runtime_error(
-		  "texture image format does not support linear blitting!");
+	// Records the upload of a baked texture. Every level is copied as stored,
+	// so nothing runs on the graphics queue but the ownership acquire.
+	Texture createTexture(const Ktx2File &ktx) {
+	  auto format = static_cast<vk::Format>(ktx.vkFormat());
+
+	  Texture result;
+	  result.mipLevels = ktx.levelCount();
+	  createImage(ktx.width(), ktx.height(), result.mipLevels,
+				  vk::SampleCountFlagBits::e1, format,
+				  vk::ImageTiling::eOptimal,
+				  vk::ImageUsageFlagBits::eTransferDst |
+					vk::ImageUsageFlagBits::eSampled,
+				  vk::MemoryPropertyFlagBits::eDeviceLocal, result.image,
+				  result.allocation);
+
+	  transitionImageLayout(result.image, vk::ImageLayout::eUndefined,
+							vk::ImageLayout::eTransferDstOptimal,
+							result.mipLevels);
+
+	  // Copy offsets have to be multiples of the 16 byte blocks
+	  std::vector<vk::DeviceSize> offsets;
+	  vk::DeviceSize totalSize = 0;
+	  for (uint32_t level = 0; level < result.mipLevels; level++) {
+		offsets.push_back(totalSize);
+		totalSize += (ktx.level(level).size() + 15) & ~vk::DeviceSize(15);
+	  }
+	  StagingSpan staging = uploads.stage(totalSize);
+	  std::vector<vk::BufferImageCopy> regions;
+	  for (uint32_t level = 0; level < result.mipLevels; level++) {
+		std::span<const std::byte> data = ktx.level(level);
+		memcpy(static_cast<std::byte *>(staging.data) + offsets[level],
+			   data.data(), data.size());
+		regions.push_back(vk::BufferImageCopy(
+		  staging.offset + offsets[level], 0, 0,
+		  {vk::ImageAspectFlagBits::eColor, level, 0, 1}, {0, 0, 0},
+		  {ktx.width(level), ktx.height(level), 1}));
+	  }
+	  copyMipLevels(staging, result, regions);
+
+	  result.view = createImageView(result.image, format,
+									vk::ImageAspectFlagBits::eColor,
+									result.mipLevels);
+	  return result;
+	}
+
+	// Copies every level from staging and hands the texture over for
+	// sampling.
+	void copyMipLevels(const StagingSpan &staging, Texture &texture,
+					   const std::vector<vk::BufferImageCopy> &regions) {
+	  uploads.commandBuffer().copyBufferToImage(
+		staging.buffer, texture.image, vk::ImageLayout::eTransferDstOptimal,
+		regions);
+	  uploads.handOff(*texture.image,
+					  {vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0,
+					   1},
+					  vk::ImageLayout::eTransferDstOptimal,
+					  vk::ImageLayout::eShaderReadOnlyOptimal,
+					  vk::PipelineStageFlagBits2::eFragmentShader,
+					  vk::AccessFlagBits2::eShaderSampledRead);
+	  endUploadStep();
+	}
+
+	void createMipDownsampler() {
+	  std::array bindings = {
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage,
+									   DOWNSAMPLE_MAX_LEVELS - 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr)};
+	  downsampleSetLayout = vk::raii::DescriptorSetLayout(
+		device, vk::DescriptorSetLayoutCreateInfo{
+				  .bindingCount = static_cast<uint32_t>(bindings.size()),
+				  .pBindings = bindings.data()});
+
+	  vk::PushConstantRange pushConstantRange{
+		.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		.offset = 0,
+		.size = sizeof(DownsampleConstants)};
+	  downsamplePipelineLayout = vk::raii::PipelineLayout(
+		device, vk::PipelineLayoutCreateInfo{
+				  .setLayoutCount = 1,
+				  .pSetLayouts = &*downsampleSetLayout,
+				  .pushConstantRangeCount = 1,
+				  .pPushConstantRanges = &pushConstantRange});
+
+	  vk::raii::ShaderModule shaderModule =
+		createShaderModule(readFile("shaders/downsample_shaders.spv"));
+	  vk::ComputePipelineCreateInfo pipelineInfo{
+		.stage = {.stage = vk::ShaderStageFlagBits::eCompute,
+				  .module = shaderModule,
+				  .pName = "downsampleMain"},
+		.layout = downsamplePipelineLayout};
+	  downsamplePipeline = pipelineCache.build(pipelineInfo);
+
+	  std::array poolSizes{
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage,
+							   DOWNSAMPLE_MAX_TEXTURES *
+								 (DOWNSAMPLE_MAX_LEVELS + 1)),
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+							   DOWNSAMPLE_MAX_TEXTURES)};
+	  downsampleDescriptorPool = vk::raii::DescriptorPool(
+		device, vk::DescriptorPoolCreateInfo{
+				  .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+				  .maxSets = DOWNSAMPLE_MAX_TEXTURES,
+				  .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+				  .pPoolSizes = poolSizes.data()});
+
+	  // The shader leaves the counter at 0, so it is only cleared once
+	  createBuffer(sizeof(uint32_t),
+				   vk::BufferUsageFlagBits::eStorageBuffer |
+					 vk::BufferUsageFlagBits::eTransferDst,
+				   vk::MemoryPropertyFlagBits::eDeviceLocal, downsampleCounter,
+				   downsampleCounterAllocation);
+	  const vk::raii::CommandBuffer &commandBuffer =
+		uploads.graphicsCommandBuffer();
+	  commandBuffer.fillBuffer(downsampleCounter, 0, vk::WholeSize, 0);
+	  vk::MemoryBarrier2 barrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+		.srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						 vk::AccessFlagBits2::eShaderStorageWrite};
+	  commandBuffer.pipelineBarrier2(
+		vk::DependencyInfo{.memoryBarrierCount = 1, .pMemoryBarriers = &barrier});
+	}
+
+	// Records the dispatch that writes every level of texture below the base
+	// from the base, which has to be in eGeneral on the graphics queue, and
+	// leaves the texture ready for sampling.
+	void generateMipmapsCompute(Texture &texture, uint32_t texWidth,
+								uint32_t texHeight) {
+	  if (uploads.retained() >= DOWNSAMPLE_MAX_TEXTURES) {
+		uploads.flush();
+	  }
+	  DownsampleBinding binding;
+	  for (uint32_t level = 0; level < texture.mipLevels; level++) {
+		binding.storageViews.emplace_back(
+		  device,
+		  vk::ImageViewCreateInfo{
+			.image = texture.image,
+			.viewType = vk::ImageViewType::e2D,
+			.format = vk::Format::eR8G8B8A8Unorm,
+			.subresourceRange = {vk::ImageAspectFlagBits::eColor, level, 1, 0,
+								 1}});
+	  }
+	  vk::DescriptorSetAllocateInfo allocInfo{
+		.descriptorPool = downsampleDescriptorPool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &*downsampleSetLayout};
+	  binding.set =
+		std::move(vk::raii::DescriptorSets(device, allocInfo).front());
+
+	  // Unused entries repeat the last level, so every descriptor is valid
+	  uint32_t lastLevel = texture.mipLevels - 1;
+	  auto levelInfo = [&](uint32_t level) {
+		return vk::DescriptorImageInfo{
+		  .imageView = binding.storageViews[std::min(level, lastLevel)],
+		  .imageLayout = vk::ImageLayout::eGeneral};
+	  };
+	  vk::DescriptorImageInfo baseInfo = levelInfo(0);
+	  std::array<vk::DescriptorImageInfo, DOWNSAMPLE_MAX_LEVELS - 1> mipInfos;
+	  for (uint32_t i = 0; i < mipInfos.size(); i++) {
+		mipInfos[i] = levelInfo(i + 1);
 	  }
+	  vk::DescriptorImageInfo mip6Info = levelInfo(6);
+	  vk::DescriptorBufferInfo counterInfo{
+		.buffer = downsampleCounter, .offset = 0, .range = vk::WholeSize};
+	  std::array writes{
+		vk::WriteDescriptorSet{.dstSet = binding.set,
+							   .dstBinding = 0,
+							   .descriptorCount = 1,
+							   .descriptorType =
+								 vk::DescriptorType::eStorageImage,
+							   .pImageInfo = &baseInfo},
+		vk::WriteDescriptorSet{
+		  .dstSet = binding.set,
+		  .dstBinding = 1,
+		  .descriptorCount = static_cast<uint32_t>(mipInfos.size()),
+		  .descriptorType = vk::DescriptorType::eStorageImage,
+		  .pImageInfo = mipInfos.data()},
+		vk::WriteDescriptorSet{.dstSet = binding.set,
+							   .dstBinding = 2,
+							   .descriptorCount = 1,
+							   .descriptorType =
+								 vk::DescriptorType::eStorageImage,
+							   .pImageInfo = &mip6Info},
+		vk::WriteDescriptorSet{.dstSet = binding.set,
+							   .dstBinding = 3,
+							   .descriptorCount = 1,
+							   .descriptorType =
+								 vk::DescriptorType::eStorageBuffer,
+							   .pBufferInfo = &counterInfo}};
+	  device.updateDescriptorSets(writes, {});
+
+	  uint32_t groupsX = (texWidth + DOWNSAMPLE_TILE - 1) / DOWNSAMPLE_TILE;
+	  uint32_t groupsY = (texHeight + DOWNSAMPLE_TILE - 1) / DOWNSAMPLE_TILE;
+	  DownsampleConstants constants{texWidth, texHeight, texture.mipLevels,
+									groupsX * groupsY};
+
+	  const vk::raii::CommandBuffer &commandBuffer =
+		uploads.graphicsCommandBuffer();
+	  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+								 downsamplePipeline);
+	  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+									   downsamplePipelineLayout, 0,
+									   *binding.set, nullptr);
+	  commandBuffer.pushConstants<DownsampleConstants>(
+		downsamplePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+		constants);
+	  commandBuffer.dispatch(groupsX, groupsY, 1);
+
+	  // The next dispatch uses the counter again
+	  vk::MemoryBarrier2 counterBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						 vk::AccessFlagBits2::eShaderStorageWrite};
+	  vk::ImageMemoryBarrier2 imageBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+		.oldLayout = vk::ImageLayout::eGeneral,
+		.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+		.srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+		.dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+		.image = texture.image,
+		.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0,
+							 texture.mipLevels, 0, 1}};
+	  commandBuffer.pipelineBarrier2(
+		vk::DependencyInfo{.memoryBarrierCount = 1,
+						   .pMemoryBarriers = &counterBarrier,
+						   .imageMemoryBarrierCount = 1,
+						   .pImageMemoryBarriers = &imageBarrier});
+	  uploads.retain(std::move(binding));
+
+	  endUploadStep();
+	}
 
-	  vk::raii::CommandBuffer commandBuffer = beginSingleTimeCommands();
+	// Blits each level from the one above it. Only valid for formats with
+	// linear filtering, which createTexture() checks.
+	void generateMipmaps(const vk::raii::Image& image, int32_t texWidth,
+						 int32_t texHeight, uint32_t mipLevels) {
+	  const vk::raii::CommandBuffer &commandBuffer =
+		uploads.graphicsCommandBuffer();
 
 	  vk::ImageMemoryBarrier barrier{
 		.srcAccessMask = vk::AccessFlagBits::eTransferWrite,
@@ -850,11 +2046,134 @@ class HelloTriangleApplication {
 		vk::PipelineStageFlagBits::eTransfer,
 		vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, barrier);
 
-	  endSingleTimeCommands(commandBuffer);
+	  endUploadStep();
+	}
+
+	// Times createTexture() on the decoded texture for each way of making its
+	// mips, from recording until the uploads have completed, best of 5 runs.
+	// Each chain is read back and compared with the blit one, or the CPU one
+	// without linear blits; the texture is a power of two, where all paths
+	// compute the same box filter and differ by rounding only.
+	void benchmarkTextureUpload() {
+	  constexpr int RUNS = 5;
+	  ImagePixels image = loadImagePixels(TEXTURE_PATH);
+	  std::vector<MipMode> modes;
+	  if (supportsLinearBlit(vk::Format::eR8G8B8A8Srgb)) {
+		modes.push_back(MipMode::Blit);
+	  } else {
+		std::cout << "No linear blit support, skipping the blit path"
+				  << std::endl;
+	  }
+	  modes.push_back(MipMode::Cpu);
+	  modes.push_back(MipMode::Compute);
+
+	  MipChainLayout layout = mipChainLayout(image.width, image.height);
+	  std::vector<uint8_t> reference;
+	  for (MipMode mode : modes) {
+		double best = std::numeric_limits<double>::max();
+		Texture uploaded;
+		for (int run = 0; run < RUNS; run++) {
+		  uploaded = Texture{};
+		  auto start = std::chrono::steady_clock::now();
+		  uploaded = createTexture(image.pixels.get(), image.width,
+								   image.height, mode);
+		  uploads.flush();
+		  best = std::min(best, std::chrono::duration<double, std::milli>(
+								  std::chrono::steady_clock::now() - start)
+								  .count());
+		}
+		std::vector<uint8_t> chain = readBackTexture(uploaded, layout);
+		int maxDifference = 0;
+		if (reference.empty()) {
+		  reference = std::move(chain);
+		} else {
+		  for (const MipLevelLayout &level : layout.levels) {
+			for (size_t i = level.offset; i < level.offset + level.size; i++) {
+			  maxDifference =
+				std::max(maxDifference, std::abs(int(chain[i]) - reference[i]));
+			}
+		  }
+		}
+
+		std::cout << TEXTURE_PATH << " upload with " << mipModeName(mode)
+				  << " mips";
+		if (mode == MipMode::Cpu) {
+		  std::cout << " (" << mipKernelName(bestMipKernel()) << ")";
+		}
+		std::cout << ": " << best << " ms, max difference "
+				  << maxDifference << std::endl;
+		if (maxDifference > MIP_TOLERANCE) {
+		  throw std::runtime_error(std::string(mipModeName(mode)) +
+								   " mips differ from " +
+								   mipModeName(modes[0]) + " mips");
+		}
+	  }
+	}
+
+	// Copies every level of a sampled texture back to host memory, laid out
+	// as layout. Waits for the device.
+	std::vector<uint8_t> readBackTexture(const Texture &texture,
+										 const MipChainLayout &layout) {
+	  vk::raii::Buffer buffer = nullptr;
+	  Allocation bufferAllocation;
+	  createBuffer(layout.totalSize, vk::BufferUsageFlagBits::eTransferDst,
+				   vk::MemoryPropertyFlagBits::eHostVisible |
+					 vk::MemoryPropertyFlagBits::eHostCoherent,
+				   buffer, bufferAllocation);
+
+	  std::vector<vk::BufferImageCopy> regions;
+	  for (uint32_t level = 0; level < texture.mipLevels; level++) {
+		const MipLevelLayout &entry = layout.levels[level];
+		regions.push_back(vk::BufferImageCopy(
+		  entry.offset, 0, 0, {vk::ImageAspectFlagBits::eColor, level, 0, 1},
+		  {0, 0, 0}, {entry.width, entry.height, 1}));
+	  }
+	  vk::ImageMemoryBarrier2 toTransfer{
+		.srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+		.srcAccessMask = vk::AccessFlagBits2::eNone,
+		.dstStageMask = vk::PipelineStageFlagBits2::eTransfer,
+		.dstAccessMask = vk::AccessFlagBits2::eTransferRead,
+		.oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+		.newLayout = vk::ImageLayout::eTransferSrcOptimal,
+		.srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+		.dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+		.image = texture.image,
+		.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0,
+							 texture.mipLevels, 0, 1}};
+	  vk::ImageMemoryBarrier2 toShader = toTransfer;
+	  toShader.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+	  toShader.srcAccessMask = vk::AccessFlagBits2::eNone;
+	  toShader.dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader;
+	  toShader.dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead;
+	  toShader.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+	  toShader.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	  vk::MemoryBarrier2 toHost{
+		.srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+		.srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eHost,
+		.dstAccessMask = vk::AccessFlagBits2::eHostRead};
+
+	  // The texture belongs to the graphics queue family once uploaded
+	  const vk::raii::CommandBuffer &commandBuffer =
+		uploads.graphicsCommandBuffer();
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &toTransfer});
+	  commandBuffer.copyImageToBuffer(texture.image,
+									  vk::ImageLayout::eTransferSrcOptimal,
+									  buffer, regions);
+	  commandBuffer.pipelineBarrier2(
+		vk::DependencyInfo{.memoryBarrierCount = 1,
+						   .pMemoryBarriers = &toHost,
+						   .imageMemoryBarrierCount = 1,
+						   .pImageMemoryBarriers = &toShader});
+	  uploads.flush();
+
+	  const auto *data = static_cast<const uint8_t *>(bufferAllocation.mapped());
+	  return {data, data + layout.totalSize};
 	}
 
 	void transitionImageLayout(const vk::raii::Image& image, const vk::ImageLayout oldLayout, const vk::ImageLayout newLayout, uint32_t mipLevels) {
-	  auto commandBuffer = beginSingleTimeCommands();
+	  const vk::raii::CommandBuffer &commandBuffer = uploads.commandBuffer();
 
 	  vk::ImageMemoryBarrier barrier{
 		.oldLayout = oldLayout,
@@ -887,21 +2206,21 @@ class HelloTriangleApplication {
 	  commandBuffer.pipelineBarrier(sourceStage, destinationStage, {}, {},
 									nullptr, barrier);
 
-	  endSingleTimeCommands(commandBuffer);
+	  endUploadStep();
 	}
 
-	void copyBufferToImage(const vk::raii::Buffer& buffer,
+	void copyBufferToImage(const StagingSpan &staging,
 						   vk::raii::Image &image, uint32_t width,
 						   uint32_t height) {
-	  vk::raii::CommandBuffer commandBuffer = beginSingleTimeCommands();
+	  const vk::raii::CommandBuffer &commandBuffer = uploads.commandBuffer();
 
-	  vk::BufferImageCopy region(0, 0, 0,
+	  vk::BufferImageCopy region(staging.offset, 0, 0,
 								 {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
 								 {0, 0, 0}, {width, height, 1});
 	  commandBuffer.copyBufferToImage(
-		buffer, image, vk::ImageLayout::eTransferDstOptimal, {region});
+		staging.buffer, image, vk::ImageLayout::eTransferDstOptimal, {region});
 
-	  endSingleTimeCommands(commandBuffer);
+	  endUploadStep();
 	}
 
 
@@ -915,8 +2234,10 @@ class HelloTriangleApplication {
 		vk::ImageUsageFlags usage, 
 		vk::MemoryPropertyFlags properties, 
 		vk::raii::Image& image, 
-		vk::raii::DeviceMemory& imageMemory) {
-	  vk::ImageCreateInfo imageInfo{.imageType = vk::ImageType::e2D,
+		Allocation& imageAllocation,
+		vk::ImageCreateFlags flags = {}) {
+	  vk::ImageCreateInfo imageInfo{.flags = flags,
+									.imageType = vk::ImageType::e2D,
 									.format = format,
 									.extent = {width, height, 1},
 									.mipLevels = mipLevels,
@@ -929,44 +2250,19 @@ class HelloTriangleApplication {
 
 	  image = vk::raii::Image(device, imageInfo);
 
-	  vk::MemoryRequirements memRequirements =
-		image.getMemoryRequirements();
-	  vk::MemoryAllocateInfo allocInfo{
-		.allocationSize = memRequirements.size,
-		.memoryTypeIndex =
-		  findMemoryType(memRequirements.memoryTypeBits, properties)};
-	  imageMemory = vk::raii::DeviceMemory(device, allocInfo);
-	  image.bindMemory(imageMemory, 0);
-	}
-
-	vk::raii::CommandBuffer beginSingleTimeCommands() {
-	  vk::CommandBufferAllocateInfo allocInfo{
-		.commandPool = commandPool,
-		.level = vk::CommandBufferLevel::ePrimary,
-		.commandBufferCount = 1};
-	  vk::raii::CommandBuffer commandBuffer =
-		std::move(device.allocateCommandBuffers(allocInfo).front());
-
-	  vk::CommandBufferBeginInfo beginInfo{
-		.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
-	  commandBuffer.begin(beginInfo);
-
-	  return commandBuffer;
-	}
-
-	void endSingleTimeCommands(vk::raii::CommandBuffer &commandBuffer) {
-	  commandBuffer.end();
-
-	  vk::SubmitInfo submitInfo{.commandBufferCount = 1,
-								.pCommandBuffers = &*commandBuffer};
-	  graphicsQueue.submit(submitInfo, nullptr);
-	  graphicsQueue.waitIdle();
+	  // Render targets get memory of their own
+	  bool attachment = static_cast<bool>(
+		usage & (vk::ImageUsageFlagBits::eColorAttachment |
+				 vk::ImageUsageFlagBits::eDepthStencilAttachment));
+	  imageAllocation = allocator.allocate(image, properties, tiling, attachment);
 	}
 
-	void createTextureImageView() {
-	  textureImageView =
-		createImageView(textureImage, vk::Format::eR8G8B8A8Srgb,
-						vk::ImageAspectFlagBits::eColor, mipLevels);
+	// Uploads accumulate in one batch unless batching is off, in which case
+	// each step is submitted and waited for like a single-time command.
+	void endUploadStep() {
+	  if (!options.uploadBatching) {
+		uploads.flush();
+	  }
 	}
 
 	vk::raii::ImageView createImageView(const vk::raii::Image& image, vk::Format format, vk::ImageAspectFlags aspectFlags, uint32_t mipLevels) const {
@@ -1008,140 +2304,472 @@ class HelloTriangleApplication {
 	}
 
 	void loadModel() {
-	  tinyobj::attrib_t attrib;
-	  std::vector<tinyobj::shape_t> shapes;
-	  std::vector<tinyobj::material_t> materials;
-	  std::string warn, err;
+	  MappedFile source(MODEL_PATH);
+	  if (!source.isOpen()) {
+		throw std::runtime_error("failed to open model file!");
+	  }
+	  uint64_t sourceHash = xxhash64(source.data(), source.size());
+
+	  if (meshCache.open(MODEL_CACHE_PATH, sourceHash)) {
+		meshVertices = meshCache.section<Vertex>(MeshSection::Vertices);
+		meshIndices = meshCache.section<uint32_t>(MeshSection::Indices);
+		meshMeshlets = meshCache.section<Meshlet>(MeshSection::Meshlets);
+		meshLods = meshCache.section<MeshLod>(MeshSection::Lods);
+		if (!meshVertices.empty() && !meshIndices.empty() &&
+			!meshMeshlets.empty() && !meshLods.empty()) {
+		  return;
+		}
+		meshCache.close();
+	  }
 
-	  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-							MODEL_PATH.c_str())) {
-		throw std::runtime_error(warn + err);
+	  parseModel(source);
+	  optimizeMesh();
+	  buildModelMeshlets();
+	  buildModelLods();
+	  meshVertices = vertices;
+	  meshIndices = indices;
+	  meshMeshlets = meshlets;
+	  meshLods = lods;
+
+	  if (!MeshCache::write(
+			MODEL_CACHE_PATH, sourceHash,
+			{MeshCache::makeSection(MeshSection::Vertices, meshVertices),
+			 MeshCache::makeSection(MeshSection::Indices, meshIndices),
+			 MeshCache::makeSection(MeshSection::Meshlets, meshMeshlets),
+			 MeshCache::makeSection(MeshSection::Lods, meshLods)})) {
+		std::cerr << "failed to write mesh cache " << MODEL_CACHE_PATH
+				  << std::endl;
 	  }
+	}
+
+	void parseModel(const MappedFile &source) {
+	  ObjData obj =
+		parseObj(reinterpret_cast<const char *>(source.data()), source.size(),
+				 &workerPool);
 
-	  std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	  indices.reserve(obj.corners.size());
+	  VertexWeldTable<Vertex, VertexHash> uniqueVertices(vertices,
+														 obj.corners.size());
+	  for (const auto &corner : obj.corners) {
+		indices.push_back(uniqueVertices.insert(makeObjVertex(obj, corner)));
+	  }
+	}
 
-	  for (const auto &shape : shapes) {
-		for (const auto &index : shape.mesh.indices) {
-		  Vertex vertex{};
+	// Reorders triangles for the post-transform cache, then clusters of them for
+	// overdraw, then the vertices for fetch locality. Only runs when the mesh
+	// cache is rebuilt, the cache stores the result.
+	void optimizeMesh() {
+	  VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
 
-		  vertex.pos = {attrib.vertices[3 * index.vertex_index + 0],
-						attrib.vertices[3 * index.vertex_index + 1],
-						attrib.vertices[3 * index.vertex_index + 2]};
+	  std::vector<uint32_t> clusterStarts;
+	  indices = optimizeVertexCache(indices, vertices.size(), clusterStarts);
 
-		  vertex.texCoord = {
-			attrib.texcoords[2 * index.texcoord_index + 0],
-			1.0f - attrib.texcoords[2 * index.texcoord_index +
-									1]}; // 1.0f used to flip texture
-										 // axis for alignment
+	  indices = optimizeOverdraw(indices, meshPositions(vertices), clusterStarts);
+	  optimizeVertexFetch(indices, vertices);
 
-		  vertex.color = {1.0f, 1.0f, 1.0f};
+	  VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+	  std::cout << "Mesh optimization: ACMR " << before.acmr << " -> "
+				<< after.acmr << ", ATVR " << before.atvr << " -> "
+				<< after.atvr << " (" << clusterStarts.size() << " clusters)"
+				<< std::endl;
+	}
 
-		  if (uniqueVertices.count(vertex) == 0) {
-			uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-			vertices.push_back(vertex);
-		  }
+	// Splits the optimized triangle order into meshlets, which the mesh cache
+	// stores alongside it.
+	void buildModelMeshlets() {
+	  meshlets = buildMeshlets(indices, meshPositions(vertices));
+	  size_t triangles = indices.size() / 3;
+	  std::cout << "Meshlets: " << meshlets.size() << " of "
+				<< (meshlets.empty() ? 0.0
+									 : double(triangles) / meshlets.size())
+				<< " triangles on average" << std::endl;
+	}
 
-		  indices.push_back(uniqueVertices[vertex]);
-		}
+	// Appends the coarser levels of detail to indices, after the full mesh the
+	// meshlets were cut from.
+	void buildModelLods() {
+	  lods = buildLodChain(indices, meshPositions(vertices));
+	  std::cout << "LODs:";
+	  for (const MeshLod &lod : lods) {
+		std::cout << " " << lod.indexCount / 3 << " triangles (error "
+				  << lod.error << ")";
 	  }
+	  std::cout << std::endl;
 	}
 
-	void createVertexBuffer() {
-	  vk::DeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-	  vk::BufferCreateInfo stagingInfo{
-		.size = bufferSize,
-		.usage = vk::BufferUsageFlagBits::eTransferSrc,
-		.sharingMode = vk::SharingMode::eExclusive};
-	  vk::raii::Buffer stagingBuffer(device, stagingInfo);
-	  vk::MemoryRequirements memRequirementsStaging =
-		stagingBuffer.getMemoryRequirements();
-	  vk::MemoryAllocateInfo memoryAllocateInfoStaging{
-		.allocationSize = memRequirementsStaging.size,
-		.memoryTypeIndex =
-		  findMemoryType(memRequirementsStaging.memoryTypeBits,
-						 vk::MemoryPropertyFlagBits::eHostVisible |
-						   vk::MemoryPropertyFlagBits::eHostCoherent)};
-	  vk::raii::DeviceMemory stagingBufferMemory(device,
-												 memoryAllocateInfoStaging);
-
-	  stagingBuffer.bindMemory(stagingBufferMemory, 0);
-	  void *dataStaging =
-		stagingBufferMemory.mapMemory(0, stagingInfo.size);
-	  memcpy(dataStaging, vertices.data(), stagingInfo.size);
-	  stagingBufferMemory.unmapMemory();
+	// Packed vertices need texture coordinates within [0, 1]; 16-bit indices
+	// need every vertex to be addressable by one.
+	void chooseVertexLayout() {
+	  usePackedVertices = options.packedVertices;
+	  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	  for (const auto &vertex : meshVertices) {
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+		if (vertex.texCoord.x < 0.0f || vertex.texCoord.x > 1.0f ||
+			vertex.texCoord.y < 0.0f || vertex.texCoord.y > 1.0f) {
+		  usePackedVertices = false;
+		}
+	  }
+	  if (options.packedVertices && !usePackedVertices) {
+		std::cout << "Texture coordinates outside [0, 1], using full vertices"
+				  << std::endl;
+	  }
+
+	  meshDequantize = glm::mat4(1.0f);
+	  if (usePackedVertices && !meshVertices.empty()) {
+		meshBoundsMin = boundsMin;
+		meshBoundsExtent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+		meshDequantize = glm::scale(glm::translate(glm::mat4(1.0f), boundsMin),
+									meshBoundsExtent);
+	  }
 
-	  vk::BufferCreateInfo bufferInfo{
-		.size = bufferSize,
-		.usage = vk::BufferUsageFlagBits::eVertexBuffer |
-				 vk::BufferUsageFlagBits::eTransferDst,
-		.sharingMode = vk::SharingMode::eExclusive};
-	  vertexBuffer = vk::raii::Buffer(device, bufferInfo);
+	  indexType = meshVertices.size() <= std::numeric_limits<uint16_t>::max()
+					? vk::IndexType::eUint16
+					: vk::IndexType::eUint32;
+	}
+
+	void packVertices(std::span<const Vertex> source,
+					  PackedVertex *packed) const {
+	  for (size_t i = 0; i < source.size(); i++) {
+		glm::vec3 unit = (source[i].pos - meshBoundsMin) / meshBoundsExtent;
+		packed[i] = {{quantizeUnorm16(unit.x), quantizeUnorm16(unit.y),
+					  quantizeUnorm16(unit.z), 0},
+					 {quantizeUnorm16(source[i].texCoord.x),
+					  quantizeUnorm16(source[i].texCoord.y)}};
+	  }
+	}
 
-	  vk::MemoryRequirements memRequirements =
-		vertexBuffer.getMemoryRequirements();
-	  vk::MemoryAllocateInfo memoryAllocateInfo{
-		.allocationSize = memRequirements.size,
-		.memoryTypeIndex =
-		  findMemoryType(memRequirements.memoryTypeBits,
-						 vk::MemoryPropertyFlagBits::eDeviceLocal)};
-	  vertexBufferMemory =
-		vk::raii::DeviceMemory(device, memoryAllocateInfo);
+	// Records the upload of source into target's vertex buffer, in the layout
+	// target.packed selects.
+	void createVertexBuffer(std::span<const Vertex> source, GpuMesh &target) {
+	  vk::DeviceSize bufferSize =
+		target.packed ? source.size() * sizeof(PackedVertex)
+					  : source.size_bytes();
+
+	  target.boundingSphere = boundingSphere(source);
+	  if (target.packed) {
+		target.boundingSphere = glm::vec4(
+		  (glm::vec3(target.boundingSphere) - meshBoundsMin) / meshBoundsExtent,
+		  target.boundingSphere.w);
+	  }
 
-	  vertexBuffer.bindMemory(vertexBufferMemory, 0);
+	  StagingSpan staging = uploads.stage(bufferSize);
+	  if (target.packed) {
+		packVertices(source, static_cast<PackedVertex *>(staging.data));
+	  } else {
+		memcpy(staging.data, source.data(), bufferSize);
+	  }
 
-	  copyBuffer(stagingBuffer, vertexBuffer, stagingInfo.size);
+	  createBuffer(bufferSize,
+				   vk::BufferUsageFlagBits::eVertexBuffer |
+					 vk::BufferUsageFlagBits::eTransferDst,
+				   vk::MemoryPropertyFlagBits::eDeviceLocal,
+				   target.vertexBuffer, target.vertexBufferAllocation);
+
+	  copyBuffer(staging, target.vertexBuffer,
+				 vk::PipelineStageFlagBits2::eVertexAttributeInput,
+				 vk::AccessFlagBits2::eVertexAttributeRead);
 	}
 
-	void createIndexBuffer() {
-	  vk::DeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+	// Records the upload of source into target's meshlet buffer, moved into
+	// the coordinates of its vertex buffer. Directions scale by the inverse of
+	// the packed extent, so that dequantizing them gives the model's again up
+	// to length.
+	void createMeshletBuffer(std::span<const Meshlet> source, GpuMesh &target) {
+	  vk::DeviceSize bufferSize = source.size_bytes();
+	  StagingSpan staging = uploads.stage(bufferSize);
+	  auto *data = static_cast<Meshlet *>(staging.data);
+	  memcpy(data, source.data(), bufferSize);
+	  if (target.packed) {
+		auto toBuffer = [this](const MeshPosition &p, bool direction) {
+		  glm::vec3 v(p[0], p[1], p[2]);
+		  v = (direction ? v : v - meshBoundsMin) / meshBoundsExtent;
+		  return MeshPosition{v.x, v.y, v.z};
+		};
+		for (size_t i = 0; i < source.size(); i++) {
+		  data[i].center = toBuffer(source[i].center, false);
+		  data[i].coneApex = toBuffer(source[i].coneApex, false);
+		  data[i].coneAxis = toBuffer(source[i].coneAxis, true);
+		}
+	  }
 
-	  vk::raii::Buffer stagingBuffer({});
-	  vk::raii::DeviceMemory stagingBufferMemory({});
-	  createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-				   vk::MemoryPropertyFlagBits::eHostVisible |
-					 vk::MemoryPropertyFlagBits::eHostCoherent,
-				   stagingBuffer, stagingBufferMemory);
+	  createBuffer(bufferSize,
+				   vk::BufferUsageFlagBits::eStorageBuffer |
+					 vk::BufferUsageFlagBits::eTransferDst,
+				   vk::MemoryPropertyFlagBits::eDeviceLocal,
+				   target.meshletBuffer, target.meshletBufferAllocation);
+
+	  copyBuffer(staging, target.meshletBuffer,
+				 vk::PipelineStageFlagBits2::eComputeShader,
+				 vk::AccessFlagBits2::eShaderStorageRead);
+	  target.meshletCount = static_cast<uint32_t>(source.size());
+	}
 
-	  void *data = stagingBufferMemory.mapMemory(0, bufferSize);
-	  memcpy(data, indices.data(), (size_t)bufferSize);
-	  stagingBufferMemory.unmapMemory();
+	// Same for the index buffer, with target.indexType, holding every one of
+	// lods.
+	void createIndexBuffer(std::span<const uint32_t> source,
+						   std::span<const MeshLod> lods, GpuMesh &target) {
+	  vk::DeviceSize bufferSize =
+		target.indexType == vk::IndexType::eUint16
+		  ? source.size() * sizeof(uint16_t)
+		  : source.size_bytes();
+
+	  StagingSpan staging = uploads.stage(bufferSize);
+	  void *data = staging.data;
+	  if (target.indexType == vk::IndexType::eUint16) {
+		std::transform(source.begin(), source.end(),
+					   static_cast<uint16_t *>(data),
+					   [](uint32_t index) { return static_cast<uint16_t>(index); });
+	  } else {
+		memcpy(data, source.data(), (size_t)bufferSize);
+	  }
 
 	  createBuffer(bufferSize,
 				   vk::BufferUsageFlagBits::eTransferDst |
 					 vk::BufferUsageFlagBits::eIndexBuffer,
-				   vk::MemoryPropertyFlagBits::eDeviceLocal, indexBuffer,
-				   indexBufferMemory);
-
-	  copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+				   vk::MemoryPropertyFlagBits::eDeviceLocal,
+				   target.indexBuffer, target.indexBufferAllocation);
+
+	  copyBuffer(staging, target.indexBuffer,
+				 vk::PipelineStageFlagBits2::eIndexInput,
+				 vk::AccessFlagBits2::eIndexRead);
+	  target.lods.assign(lods.begin(), lods.end());
+	  target.indexCount = lods.front().indexCount;
 	}
 
-	void createUniformBuffers() {
-	  uniformBuffers.clear();
-	  uniformBuffersMemory.clear();
-	  uniformBuffersMapped.clear();
-
-	  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-		vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
-		vk::raii::Buffer buffer({});
-		vk::raii::DeviceMemory bufferMem({});
-		createBuffer(bufferSize, vk::BufferUsageFlagBits::eUniformBuffer,
-					 vk::MemoryPropertyFlagBits::eHostVisible |
-					   vk::MemoryPropertyFlagBits::eHostCoherent,
-					 buffer, bufferMem);
-		uniformBuffers.emplace_back(std::move(buffer));
-		uniformBuffersMemory.emplace_back(std::move(bufferMem));
-		uniformBuffersMapped.emplace_back(
-		  uniformBuffersMemory[i].mapMemory(0, bufferSize));
+	// Uploads the placeholders and waits for them, which is quick, so the
+	// first frame has something to draw.
+	void createPlaceholderAssets() {
+	  mesh.indexType = vk::IndexType::eUint16;
+	  createVertexBuffer(PLACEHOLDER_VERTICES, mesh);
+	  createIndexBuffer(PLACEHOLDER_INDICES,
+						std::array{MeshLod{
+						  0, static_cast<uint32_t>(PLACEHOLDER_INDICES.size()),
+						  0.0f, 0}},
+						mesh);
+	  if (options.meshletCulling) {
+		std::vector<uint32_t> placeholderIndices(PLACEHOLDER_INDICES.begin(),
+												 PLACEHOLDER_INDICES.end());
+		createMeshletBuffer(
+		  buildMeshlets(placeholderIndices, meshPositions(PLACEHOLDER_VERTICES)),
+		  mesh);
 	  }
+	  texture = createTexture(&PLACEHOLDER_TEXEL, 1, 1, options.mipMode);
+	  texture.tableSlot = textureTable.add(texture.view, textureSampler);
+	  uploads.flush();
+	}
+
+	// Model parsing runs on a thread of its own, as it spreads work over the
+	// worker pool itself; the texture decodes on one of the workers.
+	void startAssetLoading() {
+	  modelLoad = std::async(std::launch::async, [this] {
+		loadModel();
+		chooseVertexLayout();
+	  });
+	  bool tryKtx2 = !options.noKtx2;
+	  textureLoad = workerPool.submit([tryKtx2] {
+		TextureSource source;
+		if (tryKtx2 && source.ktx.open(TEXTURE_KTX2_PATH)) {
+		  // Without the PNG there is nothing to compare, and the bake is all
+		  // there is
+		  MappedFile png(TEXTURE_PATH);
+		  if (!png.isOpen() ||
+			  source.ktx.sourceHash() == textureBakeHash(png)) {
+			return source;
+		  }
+		  std::cout << TEXTURE_KTX2_PATH << " was not baked from the current "
+					<< TEXTURE_PATH << ", decoding it instead" << std::endl;
+		  source.ktx.close();
+		}
+		source.image = loadImagePixels(TEXTURE_PATH);
+		return source;
+	  });
+	}
+
+	bool supportsSampledFormat(vk::Format format) const {
+	  vk::FormatFeatureFlags features =
+		physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+	  return (features & vk::FormatFeatureFlagBits::eSampledImage) &&
+			 (features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+	}
+
+	template <typename T> static bool isReady(const std::future<T> &future) {
+	  return future.wait_for(std::chrono::seconds(0)) ==
+			 std::future_status::ready;
+	}
+
+	// Called every frame once the frame slot's fence has signalled. Records
+	// the uploads when the loaders are done, swaps the results in when the
+	// uploads are, and frees what was swapped out once no frame uses it. A
+	// texture takes a texture table slot no submitted frame reads, so nothing
+	// has to wait for the device.
+	void updateAssets() {
+	  if (assetState == AssetState::Loading && isReady(modelLoad) &&
+		  isReady(textureLoad)) {
+		uploadAssets();
+	  }
+	  if (assetState == AssetState::Uploading &&
+		  uploads.semaphore().getCounterValue() >= assetUploadValue) {
+		swapInAssets();
+	  }
+	  while (!retiredAssets.empty() &&
+			 frameNumber >= retiredAssets.front().frame + MAX_FRAMES_IN_FLIGHT) {
+		textureTable.remove(retiredAssets.front().texture.tableSlot);
+		retiredAssets.pop_front();
+	  }
+	}
+
+	// Records and submits the uploads of the loaded model and texture without
+	// waiting for them. Rethrows what the loaders threw. A KTX2 texture in a
+	// format the device cannot sample sends the loader back to the PNG, and
+	// the assets stay loading.
+	void uploadAssets() {
+	  TextureSource source = textureLoad.get();
+	  if (source.ktx.isOpen() &&
+		  !supportsSampledFormat(static_cast<vk::Format>(source.ktx.vkFormat()))) {
+		std::cout << TEXTURE_KTX2_PATH << " uses a format the device cannot "
+				  << "sample, decoding " << TEXTURE_PATH << std::endl;
+		textureLoad = workerPool.submit([] {
+		  TextureSource fallback;
+		  fallback.image = loadImagePixels(TEXTURE_PATH);
+		  return fallback;
+		});
+		return;
+	  }
+	  modelLoad.get();
+
+	  loadedMesh.packed = usePackedVertices;
+	  loadedMesh.dequantize = meshDequantize;
+	  loadedMesh.indexType = indexType;
+	  createVertexBuffer(meshVertices, loadedMesh);
+	  createIndexBuffer(meshIndices, meshLods, loadedMesh);
+	  if (options.meshletCulling) {
+		createMeshletBuffer(meshMeshlets, loadedMesh);
+	  }
+	  if (source.ktx.isOpen()) {
+		loadedTexture = createTexture(source.ktx);
+	  } else {
+		loadedTexture =
+		  createTexture(source.image.pixels.get(), source.image.width,
+						source.image.height, options.mipMode);
+	  }
+	  assetUploadValue = uploads.submit();
+	  assetState = AssetState::Uploading;
+	}
+
+	void swapInAssets() {
+	  loadedTexture.tableSlot =
+		textureTable.add(loadedTexture.view, textureSampler);
+	  retiredAssets.push_back(
+		{frameNumber, std::move(mesh), std::move(texture)});
+	  mesh = std::move(loadedMesh);
+	  texture = std::move(loadedTexture);
+	  loadedMesh = GpuMesh{};
+	  loadedTexture = Texture{};
+	  // Handles of retired buffers may come back for new ones
+	  cullSetMeshlets.fill(nullptr);
+	  sceneVersion++;
+	  assetState = AssetState::Resident;
+	  std::cout << "Assets resident after " << millisecondsSinceLaunch()
+				<< " ms (uploads: " << uploads.submits() << " submits, "
+				<< uploads.stalls() << " stalls, "
+				<< (uploads.hasTransferQueue() ? "transfer queue family "
+											   : "graphics queue family ")
+				<< transferIndex << ")" << std::endl;
+	}
+
+	// Blocks until the assets are resident, for runs that should not see the
+	// placeholders.
+	void waitForAssets() {
+	  while (assetState == AssetState::Loading) {
+		modelLoad.wait();
+		textureLoad.wait();
+		uploadAssets();
+	  }
+	  if (assetState == AssetState::Uploading) {
+		uploads.wait(assetUploadValue);
+		swapInAssets();
+	  }
+	}
+
+	double millisecondsSinceLaunch() const {
+	  return std::chrono::duration<double, std::milli>(
+			   std::chrono::steady_clock::now() - launchTime)
+		.count();
+	}
+
+	void createUniformBuffers() {
+	  uniformBuffers.clear();
+	  uniformBufferAllocations.clear();
+	  uniformBuffersMapped.clear();
+
+	  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
+		vk::raii::Buffer buffer({});
+		Allocation bufferAllocation;
+		createBuffer(bufferSize, vk::BufferUsageFlagBits::eUniformBuffer,
+					 vk::MemoryPropertyFlagBits::eHostVisible |
+					   vk::MemoryPropertyFlagBits::eHostCoherent,
+					 buffer, bufferAllocation);
+		uniformBuffers.emplace_back(std::move(buffer));
+		uniformBuffersMapped.emplace_back(bufferAllocation.mapped());
+		uniformBufferAllocations.emplace_back(std::move(bufferAllocation));
+	  }
+	}
+
+	// Sized for the largest instance count this run draws.
+	void createInstanceBuffers() {
+	  instanceCount = std::max(options.instances, 1u);
+	  instanceCapacity = instanceCount;
+	  if (options.benchInstances) {
+		instanceCapacity = std::max(instanceCapacity, INSTANCE_SWEEP.back());
+	  }
+	  instanceBuffers.clear();
+	  instanceBufferAllocations.clear();
+	  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vk::raii::Buffer buffer = nullptr;
+		Allocation bufferAllocation;
+		createBuffer(vk::DeviceSize(instanceCapacity) * sizeof(InstanceData),
+					 vk::BufferUsageFlagBits::eStorageBuffer,
+					 vk::MemoryPropertyFlagBits::eHostVisible |
+					   vk::MemoryPropertyFlagBits::eHostCoherent,
+					 buffer, bufferAllocation);
+		instanceBuffers.emplace_back(std::move(buffer));
+		instanceBufferAllocations.emplace_back(std::move(bufferAllocation));
+	  }
+	  instanceBufferGeneration.fill(0);
+	}
+
+	void setInstanceCount(uint32_t count) {
+	  if (count > instanceCapacity) {
+		throw std::runtime_error("instance count exceeds the instance buffers!");
+	  }
+	  instanceCount = count;
+	  instanceGeneration++;
+	  sceneVersion++;
+	}
+
+	// Brings the frame slot's instance buffer up to date. The slot's fence
+	// has signalled, so no submitted frame reads it.
+	void updateInstanceBuffer(uint32_t frame) {
+	  if (instanceBufferGeneration[frame] == instanceGeneration) {
+		return;
+	  }
+	  auto *instances =
+		static_cast<InstanceData *>(instanceBufferAllocations[frame].mapped());
+	  for (uint32_t i = 0; i < instanceCount; i++) {
+		instances[i].model = instanceTransform(i, instanceCount);
+	  }
+	  instanceBufferGeneration[frame] = instanceGeneration;
 	}
 
 	void createDescriptorPool() {
 	  std::array poolSize{
 		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer,
 							   MAX_FRAMES_IN_FLIGHT),
-		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler,
-							   MAX_FRAMES_IN_FLIGHT)};
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+							   2 * MAX_FRAMES_IN_FLIGHT)};
 	  vk::DescriptorPoolCreateInfo poolInfo{
 		.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
 		.maxSets = MAX_FRAMES_IN_FLIGHT,
@@ -1166,57 +2794,885 @@ class HelloTriangleApplication {
 											.offset = 0,
 											.range =
 											  sizeof(UniformBufferObject)};
-		vk::DescriptorImageInfo imageInfo{
-		  .sampler = textureSampler,
-		  .imageView = textureImageView,
-		  .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal};
+		vk::DescriptorBufferInfo instanceInfo{.buffer = instanceBuffers[i],
+											  .offset = 0,
+											  .range = vk::WholeSize};
 		std::array descriptorWrites{
-		  vk::WriteDescriptorSet{.dstSet = descriptorSets[i],
-								 .dstBinding = 0,
-								 .dstArrayElement = 0,
-								 .descriptorCount = 1,
-								 .descriptorType =
-								   vk::DescriptorType::eUniformBuffer,
-								 .pBufferInfo = &bufferInfo},
+		  vk::WriteDescriptorSet{
+			.dstSet = descriptorSets[i],
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eUniformBuffer,
+			.pBufferInfo = &bufferInfo},
 		  vk::WriteDescriptorSet{
 			.dstSet = descriptorSets[i],
 			.dstBinding = 1,
 			.dstArrayElement = 0,
 			.descriptorCount = 1,
-			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
-			.pImageInfo = &imageInfo}};
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &instanceInfo}};
+
+		device.updateDescriptorSets(descriptorWrites, {});
+	  }
+	}
 
+	// The cull pipeline and, per frame slot, its descriptor set and buffers:
+	// per phase, a draw per level of detail and a list of instanceCapacity
+	// visible instances for each. Meshlet culling grows them once the mesh
+	// is known. Occlusion culling adds the visibility buffer and the depth
+	// pyramid pipelines.
+	void createCullPass() {
+	  vk::PhysicalDeviceFeatures coreFeatures = physicalDevice.getFeatures();
+	  if (!coreFeatures.drawIndirectFirstInstance ||
+		  !coreFeatures.multiDrawIndirect) {
+		throw std::runtime_error(
+		  "GPU culling needs multiDrawIndirect and drawIndirectFirstInstance!");
+	  }
+	  // cull.slang counts with wave intrinsics, which are ballots
+	  auto properties = physicalDevice.getProperties2<
+		vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+	  const auto &subgroup =
+		properties.get<vk::PhysicalDeviceSubgroupProperties>();
+	  if (!(subgroup.supportedStages & vk::ShaderStageFlagBits::eCompute) ||
+		  !(subgroup.supportedOperations &
+			vk::SubgroupFeatureFlagBits::eBallot)) {
+		throw std::runtime_error(
+		  "GPU culling needs subgroup ballot operations in compute shaders!");
+	  }
+
+	  std::array bindings = {
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(5, vk::DescriptorType::eSampledImage,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(6, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(7, vk::DescriptorType::eStorageBuffer,
+									   1, vk::ShaderStageFlagBits::eCompute,
+									   nullptr)};
+	  // The visibility buffer and depth pyramid are left unwritten without
+	  // occlusion culling, whose phases are the only ones to read them, and
+	  // the meshlets without meshlet culling
+	  std::vector<vk::DescriptorBindingFlags> bindingFlags(bindings.size());
+	  bindingFlags[4] = vk::DescriptorBindingFlagBits::ePartiallyBound;
+	  bindingFlags[5] = vk::DescriptorBindingFlagBits::ePartiallyBound;
+	  bindingFlags[6] = vk::DescriptorBindingFlagBits::ePartiallyBound;
+	  vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{
+		.bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+		.pBindingFlags = bindingFlags.data()};
+	  cullSetLayout = vk::raii::DescriptorSetLayout(
+		device, vk::DescriptorSetLayoutCreateInfo{
+				  .pNext = &bindingFlagsInfo,
+				  .bindingCount = static_cast<uint32_t>(bindings.size()),
+				  .pBindings = bindings.data()});
+
+	  vk::PushConstantRange pushConstantRange{
+		.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		.offset = 0,
+		.size = sizeof(CullConstants)};
+	  cullPipelineLayout = vk::raii::PipelineLayout(
+		device, vk::PipelineLayoutCreateInfo{
+				  .setLayoutCount = 1,
+				  .pSetLayouts = &*cullSetLayout,
+				  .pushConstantRangeCount = 1,
+				  .pPushConstantRanges = &pushConstantRange});
+
+	  vk::raii::ShaderModule shaderModule =
+		createShaderModule(readFile("shaders/cull_shaders.spv"));
+	  vk::ComputePipelineCreateInfo pipelineInfo{
+		.stage = {.stage = vk::ShaderStageFlagBits::eCompute,
+				  .module = shaderModule,
+				  .pName = options.meshletCulling ? "cullMeshletsMain"
+												  : "cullMain"},
+		.layout = cullPipelineLayout};
+	  cullPipeline = pipelineCache.build(pipelineInfo);
+
+	  std::array poolSizes{
+		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer,
+							   MAX_FRAMES_IN_FLIGHT),
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+							   6 * MAX_FRAMES_IN_FLIGHT),
+		vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage,
+							   MAX_FRAMES_IN_FLIGHT)};
+	  cullDescriptorPool = vk::raii::DescriptorPool(
+		device, vk::DescriptorPoolCreateInfo{
+				  .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+				  .maxSets = MAX_FRAMES_IN_FLIGHT,
+				  .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+				  .pPoolSizes = poolSizes.data()});
+	  std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+												   *cullSetLayout);
+	  cullDescriptorSets = device.allocateDescriptorSets(
+		vk::DescriptorSetAllocateInfo{
+		  .descriptorPool = cullDescriptorPool,
+		  .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
+		  .pSetLayouts = layouts.data()});
+
+	  if (options.occlusionCulling) {
+		// Nothing was visible before the first frame
+		createBuffer(vk::DeviceSize(instanceCapacity) * sizeof(uint32_t),
+					 vk::BufferUsageFlagBits::eStorageBuffer |
+					   vk::BufferUsageFlagBits::eTransferDst,
+					 vk::MemoryPropertyFlagBits::eDeviceLocal,
+					 visibilityBuffer, visibilityBufferAllocation);
+		const vk::raii::CommandBuffer &commandBuffer =
+		  uploads.graphicsCommandBuffer();
+		commandBuffer.fillBuffer(visibilityBuffer, 0, vk::WholeSize, 0);
+		vk::MemoryBarrier2 barrier{
+		  .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+		  .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+		  .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		  .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						   vk::AccessFlagBits2::eShaderStorageWrite};
+		commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		  .memoryBarrierCount = 1, .pMemoryBarriers = &barrier});
+		// Frames use it from the first one on
+		uploads.flush();
+	  }
+
+	  uint32_t phases = options.occlusionCulling ? 2 : 1;
+	  drawCapacity = MAX_MESH_LODS;
+	  cullDrawLists.fill(phases * drawCapacity);
+	  drawCommandBuffers.clear();
+	  drawCommandBufferAllocations.clear();
+	  visibleInstanceBuffers.clear();
+	  visibleInstanceBufferAllocations.clear();
+	  cullCounterBuffers.clear();
+	  cullCounterBufferAllocations.clear();
+	  cullStatsBuffers.clear();
+	  cullStatsBufferAllocations.clear();
+	  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vk::raii::Buffer commands = nullptr;
+		Allocation commandsAllocation;
+		createBuffer(vk::DeviceSize(phases) * drawCapacity *
+					   sizeof(vk::DrawIndexedIndirectCommand),
+					 vk::BufferUsageFlagBits::eStorageBuffer |
+					   vk::BufferUsageFlagBits::eIndirectBuffer |
+					   vk::BufferUsageFlagBits::eTransferDst,
+					 vk::MemoryPropertyFlagBits::eDeviceLocal, commands,
+					 commandsAllocation);
+		vk::raii::Buffer visible = nullptr;
+		Allocation visibleAllocation;
+		createBuffer(vk::DeviceSize(phases) * drawCapacity * instanceCapacity *
+					   sizeof(uint32_t),
+					 vk::BufferUsageFlagBits::eStorageBuffer,
+					 vk::MemoryPropertyFlagBits::eDeviceLocal, visible,
+					 visibleAllocation);
+		vk::raii::Buffer counters = nullptr;
+		Allocation countersAllocation;
+		createBuffer(sizeof(CullStats),
+					 vk::BufferUsageFlagBits::eStorageBuffer |
+					   vk::BufferUsageFlagBits::eIndirectBuffer |
+					   vk::BufferUsageFlagBits::eTransferSrc |
+					   vk::BufferUsageFlagBits::eTransferDst,
+					 vk::MemoryPropertyFlagBits::eDeviceLocal, counters,
+					 countersAllocation);
+		vk::raii::Buffer stats = nullptr;
+		Allocation statsAllocation;
+		createBuffer(sizeof(CullStats), vk::BufferUsageFlagBits::eTransferDst,
+					 vk::MemoryPropertyFlagBits::eHostVisible |
+					   vk::MemoryPropertyFlagBits::eHostCoherent,
+					 stats, statsAllocation);
+
+		vk::DescriptorBufferInfo uniformInfo{.buffer = uniformBuffers[i],
+											 .offset = 0,
+											 .range =
+											   sizeof(UniformBufferObject)};
+		vk::DescriptorBufferInfo instanceInfo{.buffer = instanceBuffers[i],
+											  .offset = 0,
+											  .range = vk::WholeSize};
+		vk::DescriptorBufferInfo countersInfo{
+		  .buffer = counters, .offset = 0, .range = vk::WholeSize};
+		vk::DescriptorBufferInfo visibilityInfo{
+		  .buffer = visibilityBuffer, .offset = 0, .range = vk::WholeSize};
+		std::vector<vk::WriteDescriptorSet> descriptorWrites{
+		  vk::WriteDescriptorSet{
+			.dstSet = cullDescriptorSets[i],
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eUniformBuffer,
+			.pBufferInfo = &uniformInfo},
+		  vk::WriteDescriptorSet{
+			.dstSet = cullDescriptorSets[i],
+			.dstBinding = 1,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &instanceInfo},
+		  vk::WriteDescriptorSet{
+			.dstSet = cullDescriptorSets[i],
+			.dstBinding = 3,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &countersInfo}};
+		if (options.occlusionCulling) {
+		  descriptorWrites.push_back(vk::WriteDescriptorSet{
+			.dstSet = cullDescriptorSets[i],
+			.dstBinding = 4,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &visibilityInfo});
+		}
 		device.updateDescriptorSets(descriptorWrites, {});
+		writeDrawListSets(i, commands, visible);
+
+		drawCommandBuffers.emplace_back(std::move(commands));
+		drawCommandBufferAllocations.emplace_back(std::move(commandsAllocation));
+		visibleInstanceBuffers.emplace_back(std::move(visible));
+		visibleInstanceBufferAllocations.emplace_back(
+		  std::move(visibleAllocation));
+		cullCounterBuffers.emplace_back(std::move(counters));
+		cullCounterBufferAllocations.emplace_back(std::move(countersAllocation));
+		cullStatsBuffers.emplace_back(std::move(stats));
+		cullStatsBufferAllocations.emplace_back(std::move(statsAllocation));
+	  }
+	  cullStatsTested.fill(0);
+	  cullSetMeshlets.fill(nullptr);
+
+	  if (options.occlusionCulling) {
+		createDepthPyramidPipelines();
+		createDepthPyramid();
+	  }
+	}
+
+	// Points the slot's cull set at its draws and visible instance lists, and
+	// the slot's graphics set at the lists: the cull pass fills them, the
+	// vertex shader reads them.
+	void writeDrawListSets(size_t slot, vk::Buffer commands, vk::Buffer visible) {
+	  vk::DescriptorBufferInfo commandsInfo{
+		.buffer = commands, .offset = 0, .range = vk::WholeSize};
+	  vk::DescriptorBufferInfo visibleInfo{
+		.buffer = visible, .offset = 0, .range = vk::WholeSize};
+	  std::array<vk::WriteDescriptorSet, 3> descriptorWrites{
+		vk::WriteDescriptorSet{
+		  .dstSet = cullDescriptorSets[slot],
+		  .dstBinding = 2,
+		  .descriptorCount = 1,
+		  .descriptorType = vk::DescriptorType::eStorageBuffer,
+		  .pBufferInfo = &commandsInfo},
+		vk::WriteDescriptorSet{
+		  .dstSet = cullDescriptorSets[slot],
+		  .dstBinding = 7,
+		  .descriptorCount = 1,
+		  .descriptorType = vk::DescriptorType::eStorageBuffer,
+		  .pBufferInfo = &visibleInfo},
+		vk::WriteDescriptorSet{
+		  .dstSet = descriptorSets[slot],
+		  .dstBinding = 2,
+		  .descriptorCount = 1,
+		  .descriptorType = vk::DescriptorType::eStorageBuffer,
+		  .pBufferInfo = &visibleInfo}};
+	  device.updateDescriptorSets(descriptorWrites, {});
+	}
+
+	// The meshlet phase draws every meshlet of the mesh, each instanced over
+	// its own list of up to instanceCapacity visible instances. The mesh is
+	// only known once it has loaded, so the slot's draws and lists grow here,
+	// after its fence has signalled and before anything is recorded into them.
+	void reserveMeshletDraws() {
+	  if (mesh.meshletCount <= cullDrawLists[currentFrame]) {
+		return;
+	  }
+	  vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+	  vk::DeviceSize commandBytes = vk::DeviceSize(mesh.meshletCount) *
+									sizeof(vk::DrawIndexedIndirectCommand);
+	  vk::DeviceSize listBytes = vk::DeviceSize(mesh.meshletCount) *
+								 instanceCapacity * sizeof(uint32_t);
+	  if (mesh.meshletCount > limits.maxDrawIndirectCount ||
+		  std::max(commandBytes, listBytes) > limits.maxStorageBufferRange) {
+		throw std::runtime_error("mesh has too many meshlets to draw " +
+								 std::to_string(instanceCapacity) +
+								 " instances of each!");
 	  }
+	  vk::raii::Buffer commands = nullptr;
+	  Allocation commandsAllocation;
+	  createBuffer(commandBytes,
+				   vk::BufferUsageFlagBits::eStorageBuffer |
+					 vk::BufferUsageFlagBits::eIndirectBuffer |
+					 vk::BufferUsageFlagBits::eTransferDst,
+				   vk::MemoryPropertyFlagBits::eDeviceLocal, commands,
+				   commandsAllocation);
+	  vk::raii::Buffer visible = nullptr;
+	  Allocation visibleAllocation;
+	  createBuffer(listBytes, vk::BufferUsageFlagBits::eStorageBuffer,
+				   vk::MemoryPropertyFlagBits::eDeviceLocal, visible,
+				   visibleAllocation);
+	  writeDrawListSets(currentFrame, commands, visible);
+	  drawCommandBuffers[currentFrame] = std::move(commands);
+	  drawCommandBufferAllocations[currentFrame] = std::move(commandsAllocation);
+	  visibleInstanceBuffers[currentFrame] = std::move(visible);
+	  visibleInstanceBufferAllocations[currentFrame] =
+		std::move(visibleAllocation);
+	  cullDrawLists[currentFrame] = mesh.meshletCount;
 	}
 
-	void copyBuffer(vk::raii::Buffer &srcBuffer,
-					vk::raii::Buffer &dstBuffer, vk::DeviceSize size) {
-	  vk::raii::CommandBuffer commandCopyBuffer = beginSingleTimeCommands();
-	  commandCopyBuffer.copyBuffer(srcBuffer, dstBuffer,
-								   vk::BufferCopy(0, 0, size));
-	  endSingleTimeCommands(commandCopyBuffer);
+	void createDepthPyramidPipelines() {
+	  vk::Format depthFormat = findDepthFormat();
+	  if (!(physicalDevice.getFormatProperties(depthFormat)
+			  .optimalTilingFeatures &
+			vk::FormatFeatureFlagBits::eSampledImage) ||
+		  !(physicalDevice.getProperties().limits.sampledImageDepthSampleCounts &
+			msaaSamples)) {
+		throw std::runtime_error(
+		  "occlusion culling needs a depth attachment shaders can read!");
+	  }
+
+	  std::array bindings = {
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eSampledImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr),
+		vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eSampledImage, 1,
+									   vk::ShaderStageFlagBits::eCompute,
+									   nullptr)};
+	  pyramidSetLayout = vk::raii::DescriptorSetLayout(
+		device, vk::DescriptorSetLayoutCreateInfo{
+				  .bindingCount = static_cast<uint32_t>(bindings.size()),
+				  .pBindings = bindings.data()});
+
+	  vk::PushConstantRange pushConstantRange{
+		.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		.offset = 0,
+		.size = sizeof(PyramidConstants)};
+	  pyramidPipelineLayout = vk::raii::PipelineLayout(
+		device, vk::PipelineLayoutCreateInfo{
+				  .setLayoutCount = 1,
+				  .pSetLayouts = &*pyramidSetLayout,
+				  .pushConstantRangeCount = 1,
+				  .pPushConstantRanges = &pushConstantRange});
+
+	  vk::raii::ShaderModule shaderModule =
+		createShaderModule(readFile("shaders/depth_pyramid_shaders.spv"));
+	  vk::ComputePipelineCreateInfo pipelineInfo{
+		.stage = {.stage = vk::ShaderStageFlagBits::eCompute,
+				  .module = shaderModule,
+				  .pName = msaaSamples == vk::SampleCountFlagBits::e1
+							 ? "depthMain"
+							 : "depthMultisampledMain"},
+		.layout = pyramidPipelineLayout};
+	  pyramidDepthPipeline = pipelineCache.build(pipelineInfo);
+	  pipelineInfo.stage.pName = "reduceMain";
+	  pyramidReducePipeline = pipelineCache.build(pipelineInfo);
+
+	  std::array poolSizes{
+		vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage,
+							   PYRAMID_MAX_LEVELS),
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage,
+							   2 * PYRAMID_MAX_LEVELS)};
+	  pyramidDescriptorPool = vk::raii::DescriptorPool(
+		device, vk::DescriptorPoolCreateInfo{
+				  .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+				  .maxSets = PYRAMID_MAX_LEVELS,
+				  .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+				  .pPoolSizes = poolSizes.data()});
+	}
+
+	// The depth pyramid for the current depth attachment, which is the
+	// attachment rounded down to powers of two. Rebuilt with the swapchain.
+	void createDepthPyramid() {
+	  depthPyramidSets.clear();
+	  depthPyramidLevelViews.clear();
+	  depthPyramidView = nullptr;
+
+	  pyramidWidth = previousPowerOfTwo(swapChainExtent.width);
+	  pyramidHeight = previousPowerOfTwo(swapChainExtent.height);
+	  pyramidLevels = mipLevelCount(pyramidWidth, pyramidHeight);
+	  createImage(pyramidWidth, pyramidHeight, pyramidLevels,
+				  vk::SampleCountFlagBits::e1, vk::Format::eR32Sfloat,
+				  vk::ImageTiling::eOptimal,
+				  vk::ImageUsageFlagBits::eStorage |
+					vk::ImageUsageFlagBits::eSampled,
+				  vk::MemoryPropertyFlagBits::eDeviceLocal, depthPyramid,
+				  depthPyramidAllocation);
+	  depthPyramidView =
+		createImageView(depthPyramid, vk::Format::eR32Sfloat,
+						vk::ImageAspectFlagBits::eColor, pyramidLevels);
+	  for (uint32_t level = 0; level < pyramidLevels; level++) {
+		depthPyramidLevelViews.emplace_back(
+		  device,
+		  vk::ImageViewCreateInfo{
+			.image = depthPyramid,
+			.viewType = vk::ImageViewType::e2D,
+			.format = vk::Format::eR32Sfloat,
+			.subresourceRange = {vk::ImageAspectFlagBits::eColor, level, 1, 0,
+								 1}});
+	  }
+
+	  std::vector<vk::DescriptorSetLayout> layouts(pyramidLevels,
+												   *pyramidSetLayout);
+	  depthPyramidSets = device.allocateDescriptorSets(
+		vk::DescriptorSetAllocateInfo{
+		  .descriptorPool = pyramidDescriptorPool,
+		  .descriptorSetCount = pyramidLevels,
+		  .pSetLayouts = layouts.data()});
+	  vk::DescriptorImageInfo depthInfo{
+		.imageView = depthImageView,
+		.imageLayout = vk::ImageLayout::eDepthReadOnlyOptimal};
+	  std::vector<vk::DescriptorImageInfo> levelInfos;
+	  for (const auto &view : depthPyramidLevelViews) {
+		levelInfos.push_back(vk::DescriptorImageInfo{
+		  .imageView = view, .imageLayout = vk::ImageLayout::eGeneral});
+	  }
+	  // Level 0 reads the attachment through the binding matching its
+	  // samples, the others the level below
+	  std::vector<vk::WriteDescriptorSet> writes{vk::WriteDescriptorSet{
+		.dstSet = depthPyramidSets[0],
+		.dstBinding = msaaSamples == vk::SampleCountFlagBits::e1 ? 0u : 3u,
+		.descriptorCount = 1,
+		.descriptorType = vk::DescriptorType::eSampledImage,
+		.pImageInfo = &depthInfo}};
+	  for (uint32_t level = 0; level < pyramidLevels; level++) {
+		if (level > 0) {
+		  writes.push_back(vk::WriteDescriptorSet{
+			.dstSet = depthPyramidSets[level],
+			.dstBinding = 1,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageImage,
+			.pImageInfo = &levelInfos[level - 1]});
+		}
+		writes.push_back(vk::WriteDescriptorSet{
+		  .dstSet = depthPyramidSets[level],
+		  .dstBinding = 2,
+		  .descriptorCount = 1,
+		  .descriptorType = vk::DescriptorType::eStorageImage,
+		  .pImageInfo = &levelInfos[level]});
+	  }
+	  vk::DescriptorImageInfo pyramidInfo{
+		.imageView = depthPyramidView,
+		.imageLayout = vk::ImageLayout::eGeneral};
+	  for (const auto &set : cullDescriptorSets) {
+		writes.push_back(vk::WriteDescriptorSet{
+		  .dstSet = set,
+		  .dstBinding = 5,
+		  .descriptorCount = 1,
+		  .descriptorType = vk::DescriptorType::eSampledImage,
+		  .pImageInfo = &pyramidInfo});
+	  }
+	  device.updateDescriptorSets(writes, {});
+	}
+
+	// The phase that opens each frame's culling and draws
+	CullPhase firstCullPhase() const {
+	  if (options.meshletCulling) {
+		return CullPhase::Meshlets;
+	  }
+	  return options.occlusionCulling ? CullPhase::Early : CullPhase::Frustum;
+	}
+
+	// Records one cull dispatch and makes its draws ready for the indirect
+	// draw. Every phase but the late one first clears the frame slot's
+	// counters; the meshlet phase also sets up its draws with a dispatch of
+	// its own. However many instances there are, this is the same few
+	// commands.
+	void recordCulling(const vk::raii::CommandBuffer &commandBuffer,
+					   CullPhase phase) {
+	  if (phase == CullPhase::Meshlets) {
+		reserveMeshletDraws();
+	  }
+	  if (phase == CullPhase::Meshlets &&
+		  cullSetMeshlets[currentFrame] != *mesh.meshletBuffer) {
+		// The slot's fence has signalled, so nothing still reads the set
+		vk::DescriptorBufferInfo meshletInfo{
+		  .buffer = mesh.meshletBuffer, .offset = 0, .range = vk::WholeSize};
+		device.updateDescriptorSets(
+		  vk::WriteDescriptorSet{
+			.dstSet = cullDescriptorSets[currentFrame],
+			.dstBinding = 6,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &meshletInfo},
+		  {});
+		cullSetMeshlets[currentFrame] = *mesh.meshletBuffer;
+	  }
+
+	  if (phase == CullPhase::Frustum || phase == CullPhase::Early) {
+		// Each phase draws every level of detail from its own range of the
+		// visible instances, as many instances as the cull pass adds
+		uint32_t phases = options.occlusionCulling ? 2 : 1;
+		std::vector<vk::DrawIndexedIndirectCommand> draws(phases *
+														  MAX_MESH_LODS);
+		for (uint32_t draw = 0; draw < draws.size(); draw++) {
+		  uint32_t lod = draw % MAX_MESH_LODS;
+		  if (lod < mesh.lods.size()) {
+			draws[draw].indexCount = mesh.lods[lod].indexCount;
+			draws[draw].firstIndex = mesh.lods[lod].firstIndex;
+		  }
+		  draws[draw].firstInstance = draw * instanceCapacity;
+		}
+		commandBuffer.updateBuffer<vk::DrawIndexedIndirectCommand>(
+		  drawCommandBuffers[currentFrame], 0, draws);
+	  }
+	  if (phase != CullPhase::Late) {
+		commandBuffer.fillBuffer(cullCounterBuffers[currentFrame], 0,
+								 vk::WholeSize, 0);
+		// Also orders the late phase of the frame before against this one:
+		// both use the visibility buffer. The draws are read as they were
+		// written here too, apart from their instance counts.
+		vk::MemoryBarrier2 clearBarrier{
+		  .srcStageMask = vk::PipelineStageFlagBits2::eTransfer |
+						  vk::PipelineStageFlagBits2::eComputeShader,
+		  .srcAccessMask = vk::AccessFlagBits2::eTransferWrite |
+						   vk::AccessFlagBits2::eShaderStorageWrite,
+		  .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader |
+						  vk::PipelineStageFlagBits2::eDrawIndirect,
+		  .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						   vk::AccessFlagBits2::eShaderStorageWrite |
+						   vk::AccessFlagBits2::eIndirectCommandRead};
+		commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		  .memoryBarrierCount = 1, .pMemoryBarriers = &clearBarrier});
+	  }
+
+	  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+	  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+									   cullPipelineLayout, 0,
+									   *cullDescriptorSets[currentFrame],
+									   nullptr);
+	  uint32_t instanceRows = std::min(instanceCount, CULL_MAX_INSTANCE_ROWS);
+	  CullConstants constants{.boundingSphere = mesh.boundingSphere,
+							  .instanceCount = instanceCount,
+							  .phase = phase,
+							  .drawCapacity = drawCapacity,
+							  .listCapacity = instanceCapacity,
+							  .pyramidLevels = pyramidLevels,
+							  .pyramidWidth = pyramidWidth,
+							  .pyramidHeight = pyramidHeight,
+							  .meshletCount = mesh.meshletCount,
+							  .instanceRows = instanceRows};
+	  if (phase == CullPhase::Meshlets) {
+		// A draw per meshlet with no instances yet, its list where it starts
+		constants.phase = CullPhase::MeshletDraws;
+		commandBuffer.pushConstants<CullConstants>(
+		  cullPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, constants);
+		commandBuffer.dispatch(
+		  (mesh.meshletCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1,
+		  1);
+		vk::MemoryBarrier2 setupBarrier{
+		  .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		  .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		  .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		  .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						   vk::AccessFlagBits2::eShaderStorageWrite};
+		commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		  .memoryBarrierCount = 1, .pMemoryBarriers = &setupBarrier});
+		constants.phase = phase;
+	  }
+	  commandBuffer.pushConstants<CullConstants>(
+		cullPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, constants);
+	  if (phase == CullPhase::Meshlets) {
+		// Meshlets along x, instances along y
+		commandBuffer.dispatch(
+		  (mesh.meshletCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE,
+		  instanceRows, 1);
+	  } else {
+		commandBuffer.dispatch(
+		  (instanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1,
+		  1);
+	  }
+
+	  // The vertex shader reads the visible instances
+	  vk::MemoryBarrier2 drawBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eDrawIndirect |
+						vk::PipelineStageFlagBits2::eVertexShader,
+		.dstAccessMask = vk::AccessFlagBits2::eIndirectCommandRead |
+						 vk::AccessFlagBits2::eShaderStorageRead};
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.memoryBarrierCount = 1, .pMemoryBarriers = &drawBarrier});
+	}
+
+	// Between the two phases of occlusion culling, outside rendering: reduces
+	// the depth the early phase drew to the pyramid, runs the late phase
+	// against it, and hands the attachments back for the late draws.
+	void recordOcclusionPass(const vk::raii::CommandBuffer &commandBuffer) {
+	  transition_image_layout_custom(
+		depthImage, vk::ImageLayout::eDepthAttachmentOptimal,
+		vk::ImageLayout::eDepthReadOnlyOptimal,
+		vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+		vk::AccessFlagBits2::eShaderSampledRead,
+		vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+		  vk::PipelineStageFlagBits2::eLateFragmentTests,
+		vk::PipelineStageFlagBits2::eComputeShader,
+		vk::ImageAspectFlagBits::eDepth);
+	  // Every level is rewritten; waiting for the compute stage keeps the
+	  // frame before's late phase from reading what this one writes
+	  vk::ImageMemoryBarrier2 pyramidBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.oldLayout = vk::ImageLayout::eUndefined,
+		.newLayout = vk::ImageLayout::eGeneral,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = depthPyramid,
+		.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, pyramidLevels,
+							 0, 1}};
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &pyramidBarrier});
+
+	  vk::MemoryBarrier2 levelBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+						 vk::AccessFlagBits2::eShaderSampledRead};
+	  for (uint32_t level = 0; level < pyramidLevels; level++) {
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+								   level == 0 ? *pyramidDepthPipeline
+											  : *pyramidReducePipeline);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+										 pyramidPipelineLayout, 0,
+										 *depthPyramidSets[level], nullptr);
+		uint32_t width = std::max(pyramidWidth >> level, 1u);
+		uint32_t height = std::max(pyramidHeight >> level, 1u);
+		commandBuffer.pushConstants<PyramidConstants>(
+		  pyramidPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+		  PyramidConstants{width, height, swapChainExtent.width,
+						   swapChainExtent.height,
+						   static_cast<uint32_t>(msaaSamples)});
+		commandBuffer.dispatch(
+		  (width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+		  (height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, 1);
+		commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		  .memoryBarrierCount = 1, .pMemoryBarriers = &levelBarrier});
+	  }
+
+	  recordCulling(commandBuffer, CullPhase::Late);
+
+	  transition_image_layout_custom(
+		depthImage, vk::ImageLayout::eDepthReadOnlyOptimal,
+		vk::ImageLayout::eDepthAttachmentOptimal,
+		vk::AccessFlagBits2::eNone,
+		vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+		  vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+		vk::PipelineStageFlagBits2::eComputeShader,
+		vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+		  vk::PipelineStageFlagBits2::eLateFragmentTests,
+		vk::ImageAspectFlagBits::eDepth);
+	  vk::MemoryBarrier2 colorBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		.srcAccessMask = vk::AccessFlagBits2::eColorAttachmentWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		.dstAccessMask = vk::AccessFlagBits2::eColorAttachmentRead |
+						 vk::AccessFlagBits2::eColorAttachmentWrite};
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.memoryBarrierCount = 1, .pMemoryBarriers = &colorBarrier});
+	}
+
+	// Viewport, scissor, pipeline, buffers, descriptor sets and push
+	// constants of the mesh draws.
+	void bindMeshDrawState(const vk::raii::CommandBuffer &commandBuffer) {
+	  commandBuffer.setViewport(
+		0, vk::Viewport(
+			 0.0f, 0.0f, static_cast<float>(swapChainExtent.width),
+			 static_cast<float>(swapChainExtent.height), 0.0f, 1.0f));
+	  commandBuffer.setScissor(
+		0, vk::Rect2D(vk::Offset2D(0, 0), swapChainExtent));
+	  commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+								 mesh.packed ? *packedGraphicsPipeline
+											 : *graphicsPipeline);
+	  commandBuffer.bindVertexBuffers(0, *mesh.vertexBuffer, {0});
+	  commandBuffer.bindIndexBuffer(*mesh.indexBuffer, 0, mesh.indexType);
+	  commandBuffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics, pipelineLayout, 0,
+		{*descriptorSets[currentFrame], *textureTable.descriptorSet()},
+		nullptr);
+	  commandBuffer.pushConstants<DrawConstants>(
+		pipelineLayout,
+		vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+		0,
+		DrawConstants{.materialId = texture.tableSlot,
+					  .instanceList = options.gpuCulling});
+	}
+
+	// Records the mesh draws of the frame slot's secondary command buffers,
+	// one per recording thread, each taking a contiguous share of the
+	// instances. Instances are drawn in runs that need the same level of
+	// detail, so a run is a single draw. Returns the secondaries in order.
+	std::vector<vk::CommandBuffer> recordSecondaryDraws() {
+	  uint32_t threads = options.recordThreads;
+	  vk::CommandBufferInheritanceRenderingInfo renderingInheritance{
+		.colorAttachmentCount = 1,
+		.pColorAttachmentFormats = &swapChainImageFormat,
+		.depthAttachmentFormat = recordDepthFormat,
+		.rasterizationSamples = msaaSamples};
+	  vk::CommandBufferInheritanceInfo inheritance{
+		.pNext = &renderingInheritance,
+		.pipelineStatistics = gpuProfiler.inheritedStatistics()};
+
+	  workerPool.parallelFor(threads, [&](size_t thread) {
+		size_t slot = currentFrame * threads + thread;
+		recordPools[slot].reset();
+		const vk::raii::CommandBuffer &commandBuffer = recordCommandBuffers[slot];
+		commandBuffer.begin(vk::CommandBufferBeginInfo{
+		  .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+				   vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+		  .pInheritanceInfo = &inheritance});
+		bindMeshDrawState(commandBuffer);
+		auto first = static_cast<uint32_t>(uint64_t(instanceCount) * thread /
+										   threads);
+		auto end = static_cast<uint32_t>(uint64_t(instanceCount) *
+										 (thread + 1) / threads);
+		while (first < end) {
+		  uint32_t lod = instanceLod(instancePosition(first, instanceCount));
+		  uint32_t runEnd = first + 1;
+		  while (runEnd < end &&
+				 instanceLod(instancePosition(runEnd, instanceCount)) == lod) {
+			runEnd++;
+		  }
+		  commandBuffer.drawIndexed(mesh.lods[lod].indexCount, runEnd - first,
+									mesh.lods[lod].firstIndex, 0, first);
+		  first = runEnd;
+		}
+		commandBuffer.end();
+	  });
+
+	  std::vector<vk::CommandBuffer> secondaries;
+	  for (uint32_t thread = 0; thread < threads; thread++) {
+		secondaries.push_back(
+		  recordCommandBuffers[currentFrame * threads + thread]);
+	  }
+	  return secondaries;
+	}
+
+	// Binds what the mesh draws need and draws the instances, or instance
+	// meshlets, of one cull phase, or all instances without GPU culling.
+	void recordMeshDraws(const vk::raii::CommandBuffer &commandBuffer,
+						 CullPhase phase) {
+	  bindMeshDrawState(commandBuffer);
+	  if (!options.gpuCulling) {
+		const MeshLod &lod = mesh.lods[directLod];
+		commandBuffer.drawIndexed(lod.indexCount, instanceCount, lod.firstIndex,
+								  0, 0);
+		return;
+	  }
+	  if (phase == CullPhase::Meshlets) {
+		// One instanced draw per meshlet; meshlets no instance shows draw no
+		// instances
+		commandBuffer.drawIndexedIndirect(drawCommandBuffers[currentFrame], 0,
+										  mesh.meshletCount,
+										  sizeof(vk::DrawIndexedIndirectCommand));
+		return;
+	  }
+	  // One instanced draw per level of detail, the late phase's after the
+	  // early phase's; levels no instance needs draw no instances
+	  uint32_t list = phase == CullPhase::Late ? 1 : 0;
+	  commandBuffer.drawIndexedIndirect(
+		drawCommandBuffers[currentFrame],
+		vk::DeviceSize(list) * drawCapacity *
+		  sizeof(vk::DrawIndexedIndirectCommand),
+		lodCount, sizeof(vk::DrawIndexedIndirectCommand));
+	}
+
+	// Copies the frame slot's counters to where collectCullStats() reads
+	// them once the slot's fence signals.
+	void recordCullStatsCopy(const vk::raii::CommandBuffer &commandBuffer) {
+	  vk::MemoryBarrier2 copyBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eCopy,
+		.dstAccessMask = vk::AccessFlagBits2::eTransferRead};
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.memoryBarrierCount = 1, .pMemoryBarriers = &copyBarrier});
+	  commandBuffer.copyBuffer(cullCounterBuffers[currentFrame],
+							   cullStatsBuffers[currentFrame],
+							   vk::BufferCopy{0, 0, sizeof(CullStats)});
+	  vk::MemoryBarrier2 hostBarrier{
+		.srcStageMask = vk::PipelineStageFlagBits2::eCopy,
+		.srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eHost,
+		.dstAccessMask = vk::AccessFlagBits2::eHostRead};
+	  commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+		.memoryBarrierCount = 1, .pMemoryBarriers = &hostBarrier});
+	  cullStatsTested[currentFrame] = cullTestCount();
+	}
+
+	// Instances, or meshlets of all instances, one frame's culling tests
+	uint64_t cullTestCount() const {
+	  return options.meshletCulling
+			   ? uint64_t(instanceCount) * mesh.meshletCount
+			   : instanceCount;
+	}
+
+	// Reads back the cull counters of the frame slot about to be reused,
+	// whose fence has signalled, and prints them now and then.
+	void collectCullStats() {
+	  uint64_t tested = cullStatsTested[currentFrame];
+	  if (tested == 0) {
+		return;
+	  }
+	  memcpy(&cullStats, cullStatsBufferAllocations[currentFrame].mapped(),
+			 sizeof(CullStats));
+	  cullStatsTested[currentFrame] = 0;
+
+	  if (options.benchmarkFrames > 0 ||
+		  frameNumber % GPU_PROFILE_LOG_INTERVAL != 0) {
+		return;
+	  }
+	  if (options.meshletCulling) {
+		std::cout << "Culling: " << cullStats.earlyDraws << " of " << tested
+				  << " meshlets drawn, " << cullStats.outsideFrustum
+				  << " outside the frustum, " << cullStats.backfacing
+				  << " backfacing" << std::endl;
+		return;
+	  }
+	  std::cout << "Culling: " << cullStats.earlyDraws + cullStats.lateDraws
+				<< " of " << tested << " instances drawn";
+	  if (options.occlusionCulling) {
+		std::cout << " (" << cullStats.earlyDraws << " early, "
+				  << cullStats.lateDraws << " late), "
+				  << cullStats.outsideFrustum << " outside the frustum, "
+				  << cullStats.occluded << " occluded";
+	  } else {
+		std::cout << ", " << cullStats.outsideFrustum
+				  << " outside the frustum";
+	  }
+	  std::cout << std::endl;
+	}
+
+	// Copies staging into dstBuffer and hands it to the graphics queue for
+	// dstStage.
+	void copyBuffer(const StagingSpan &staging, vk::raii::Buffer &dstBuffer,
+					vk::PipelineStageFlags2 dstStage,
+					vk::AccessFlags2 dstAccess) {
+	  uploads.commandBuffer().copyBuffer(
+		staging.buffer, dstBuffer,
+		vk::BufferCopy(staging.offset, 0, staging.size));
+	  uploads.handOff(*dstBuffer, dstStage, dstAccess);
+	  endUploadStep();
 	}
 
 	void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
 					  vk::MemoryPropertyFlags properties,
 					  vk::raii::Buffer &buffer,
-					  vk::raii::DeviceMemory &bufferMemory) {
+					  Allocation &bufferAllocation) {
 	  vk::BufferCreateInfo bufferInfo{
 		.size = size,
 		.usage = usage,
 		.sharingMode = vk::SharingMode::eExclusive,
 	  };
 	  buffer = vk::raii::Buffer(device, bufferInfo);
-
-	  vk::MemoryRequirements memRequirements =
-		buffer.getMemoryRequirements();
-	  vk::MemoryAllocateInfo allocInfo{
-		.allocationSize = memRequirements.size,
-		.memoryTypeIndex =
-		  findMemoryType(memRequirements.memoryTypeBits, properties)};
-	  bufferMemory = vk::raii::DeviceMemory(device, allocInfo);
-	  buffer.bindMemory(bufferMemory, 0);
+	  bufferAllocation = allocator.allocate(buffer, properties);
 	}
 
 
@@ -1227,10 +3683,91 @@ class HelloTriangleApplication {
 		.level = vk::CommandBufferLevel::ePrimary,
 		.commandBufferCount = MAX_FRAMES_IN_FLIGHT};
 	  commandBuffers = vk::raii::CommandBuffers(device, allocInfo);
+
+	  recordCommandBuffers.clear();
+	  recordPools.clear();
+	  recordDepthFormat = findDepthFormat();
+	  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT * options.recordThreads;
+		   i++) {
+		recordPools.emplace_back(
+		  device, vk::CommandPoolCreateInfo{
+					.flags = vk::CommandPoolCreateFlagBits::eTransient,
+					.queueFamilyIndex = graphicsIndex});
+		vk::raii::CommandBuffers secondary(
+		  device, vk::CommandBufferAllocateInfo{
+					.commandPool = recordPools.back(),
+					.level = vk::CommandBufferLevel::eSecondary,
+					.commandBufferCount = 1});
+		recordCommandBuffers.emplace_back(std::move(secondary.front()));
+	  }
+	  createCachedCommandBuffers();
+	}
+
+	// Allocates a cached command buffer for every swapchain image and frame
+	// slot, none of them recorded yet.
+	void createCachedCommandBuffers() {
+	  cachedCommandBuffers.clear();
+	  if (!options.cachedCommands) {
+		return;
+	  }
+	  uint32_t count =
+		static_cast<uint32_t>(swapChainImages.size()) * MAX_FRAMES_IN_FLIGHT;
+	  cachedCommandBuffers = vk::raii::CommandBuffers(
+		device, vk::CommandBufferAllocateInfo{
+				  .commandPool = commandPool,
+				  .level = vk::CommandBufferLevel::ePrimary,
+				  .commandBufferCount = count});
+	  cachedCommandVersions.assign(count, 0);
+	  cachedCommandLods.assign(count, 0);
+	}
+
+	// Leaves the frame's commands in commandBuffers[currentFrame], recorded
+	// afresh or, with cached commands, as the cached buffer for the image and
+	// slot. That takes the place of the slot's own until
+	// releaseFrameCommands(), so everything recording into
+	// commandBuffers[currentFrame] records into it.
+	void prepareFrameCommands(uint32_t imageIndex) {
+	  if (!options.cachedCommands) {
+		commandBuffers[currentFrame].reset();
+		recordCommandBuffer(imageIndex);
+		return;
+	  }
+	  size_t cached = size_t(imageIndex) * MAX_FRAMES_IN_FLIGHT + currentFrame;
+	  std::swap(commandBuffers[currentFrame], cachedCommandBuffers[cached]);
+	  if (cachedCommandVersions[cached] == sceneVersion &&
+		  (options.gpuCulling || cachedCommandLods[cached] == directLod)) {
+		// What recording would have noted about the frame
+		gpuProfiler.replayFrame(currentFrame);
+		if (options.gpuCulling) {
+		  cullStatsTested[currentFrame] = cullTestCount();
+		}
+		return;
+	  }
+	  // The slot's fence has signalled, so the buffer is no longer pending
+	  commandBuffers[currentFrame].reset();
+	  recordCommandBuffer(imageIndex);
+	  cachedCommandVersions[cached] = sceneVersion;
+	  cachedCommandLods[cached] = directLod;
+	}
+
+	// Returns a cached command buffer to its place once submitted.
+	void releaseFrameCommands(uint32_t imageIndex) {
+	  if (options.cachedCommands) {
+		std::swap(commandBuffers[currentFrame],
+				  cachedCommandBuffers[size_t(imageIndex) *
+										 MAX_FRAMES_IN_FLIGHT +
+									   currentFrame]);
+	  }
 	}
 
 	void recordCommandBuffer(uint32_t imageIndex) {
 	  commandBuffers[currentFrame].begin({});
+	  gpuProfiler.beginFrame(commandBuffers[currentFrame], currentFrame);
+	  if (options.gpuCulling) {
+		recordCulling(commandBuffers[currentFrame], firstCullPhase());
+	  }
+	  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+						  GpuPass::Cull);
 
 	  // Before starting rendering, transition the swapchain image to
 	  // COLOR_ATTACHMENT_OPTIMAL
@@ -1261,6 +3798,8 @@ class HelloTriangleApplication {
 	    vk::PipelineStageFlagBits2::eTopOfPipe,
 	    vk::PipelineStageFlagBits2::eEarlyFragmentTests,
 		vk::ImageAspectFlagBits::eDepth );
+	  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+						  GpuPass::Barriers);
 
 	  vk::ClearValue clearColor{
 		{std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}}};
@@ -1284,36 +3823,102 @@ class HelloTriangleApplication {
 		.storeOp = vk::AttachmentStoreOp::eDontCare,
 		.clearValue = clearDepth};
 
+	  // Occlusion culling splits rendering around the depth pyramid. The
+	  // early draws keep depth for it and leave the resolve to the late ones,
+	  // which load what the early ones drew.
+	  vk::RenderingAttachmentInfo earlyColorAttachmentInfo = colorAttachmentInfo;
+	  vk::RenderingAttachmentInfo earlyDepthAttachmentInfo = depthAttachmentInfo;
+	  if (options.occlusionCulling) {
+		earlyColorAttachmentInfo.resolveMode = vk::ResolveModeFlagBits::eNone;
+		earlyColorAttachmentInfo.resolveImageView = nullptr;
+		earlyDepthAttachmentInfo.storeOp = vk::AttachmentStoreOp::eStore;
+		colorAttachmentInfo.loadOp = vk::AttachmentLoadOp::eLoad;
+		depthAttachmentInfo.loadOp = vk::AttachmentLoadOp::eLoad;
+	  }
+
 	  vk::RenderingInfo renderingInfo = {
 		.renderArea = {.offset = {0, 0}, .extent = swapChainExtent},
 		.layerCount = 1,
 		.colorAttachmentCount = 1,
 		.pColorAttachments = &colorAttachmentInfo,
 		.pDepthAttachment = &depthAttachmentInfo};
+	  vk::RenderingInfo earlyRenderingInfo = renderingInfo;
+	  earlyRenderingInfo.pColorAttachments = &earlyColorAttachmentInfo;
+	  earlyRenderingInfo.pDepthAttachment = &earlyDepthAttachmentInfo;
+
+	  gpuProfiler.beginStatistics(commandBuffers[currentFrame], currentFrame);
+	  if (options.recordThreads > 0) {
+		// Rendering that executes secondaries takes no other commands, so the
+		// draw timestamp follows its end and takes the resolve with it
+		earlyRenderingInfo.flags =
+		  vk::RenderingFlagBits::eContentsSecondaryCommandBuffers;
+		commandBuffers[currentFrame].beginRendering(earlyRenderingInfo);
+		commandBuffers[currentFrame].executeCommands(recordSecondaryDraws());
+		commandBuffers[currentFrame].endRendering();
+		for (GpuPass pass :
+			 {GpuPass::Draw, GpuPass::Occlusion, GpuPass::LateDraw}) {
+		  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame, pass);
+		}
+	  } else {
+		recordRendering(earlyRenderingInfo, renderingInfo);
+	  }
+	  gpuProfiler.endStatistics(commandBuffers[currentFrame], currentFrame);
+	  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+						  GpuPass::Resolve);
+	  recordFrameEnd(imageIndex);
+	}
 
-	  commandBuffers[currentFrame].beginRendering(renderingInfo);
-	  commandBuffers[currentFrame].setViewport(
-		0, vk::Viewport(
-			 0.0f, 0.0f, static_cast<float>(swapChainExtent.width),
-			 static_cast<float>(swapChainExtent.height), 0.0f, 1.0f));
-	  commandBuffers[currentFrame].setScissor(
-		0, vk::Rect2D(vk::Offset2D(0, 0), swapChainExtent));
-	  commandBuffers[currentFrame].bindPipeline(
-		vk::PipelineBindPoint::eGraphics, *graphicsPipeline);
-	  commandBuffers[currentFrame].bindVertexBuffers(0, *vertexBuffer, {0});
-	  commandBuffers[currentFrame].bindIndexBuffer(*indexBuffer, 0,
-												   vk::IndexType::eUint32);
-	  commandBuffers[currentFrame].bindDescriptorSets(
-		vk::PipelineBindPoint::eGraphics, pipelineLayout, 0,
-		*descriptorSets[currentFrame], nullptr);
-	  commandBuffers[currentFrame].drawIndexed(indices.size(), 1, 0, 0, 0);
+	// Records the mesh draws inline: the only rendering, or the early and late
+	// ones of occlusion culling around the depth pyramid.
+	void recordRendering(const vk::RenderingInfo &earlyRenderingInfo,
+						 const vk::RenderingInfo &renderingInfo) {
+	  commandBuffers[currentFrame].beginRendering(earlyRenderingInfo);
+	  recordMeshDraws(commandBuffers[currentFrame], firstCullPhase());
+	  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+						  GpuPass::Draw);
+	  if (options.occlusionCulling) {
+		commandBuffers[currentFrame].endRendering();
+		recordOcclusionPass(commandBuffers[currentFrame]);
+		gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+							GpuPass::Occlusion);
+		commandBuffers[currentFrame].beginRendering(renderingInfo);
+		recordMeshDraws(commandBuffers[currentFrame], CullPhase::Late);
+		gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+							GpuPass::LateDraw);
+	  } else {
+		gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+							GpuPass::Occlusion);
+		gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+							GpuPass::LateDraw);
+	  }
 	  commandBuffers[currentFrame].endRendering();
-	  transition_image_layout(
-		imageIndex, vk::ImageLayout::eColorAttachmentOptimal,
-		vk::ImageLayout::ePresentSrcKHR,
-		vk::AccessFlagBits2::eColorAttachmentWrite, {},
-		vk::PipelineStageFlagBits2::eColorAttachmentOutput,
-		vk::PipelineStageFlagBits2::eBottomOfPipe);
+	}
+
+	// Everything after rendering: the cull stats copy and the transition of
+	// the frame's image for presenting or copying out.
+	void recordFrameEnd(uint32_t imageIndex) {
+	  if (options.gpuCulling) {
+		recordCullStatsCopy(commandBuffers[currentFrame]);
+	  }
+	  if (options.headless) {
+		// Leave offscreen targets ready to be copied out
+		transition_image_layout(
+		  imageIndex, vk::ImageLayout::eColorAttachmentOptimal,
+		  vk::ImageLayout::eTransferSrcOptimal,
+		  vk::AccessFlagBits2::eColorAttachmentWrite,
+		  vk::AccessFlagBits2::eTransferRead,
+		  vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		  vk::PipelineStageFlagBits2::eTransfer);
+	  } else {
+		transition_image_layout(
+		  imageIndex, vk::ImageLayout::eColorAttachmentOptimal,
+		  vk::ImageLayout::ePresentSrcKHR,
+		  vk::AccessFlagBits2::eColorAttachmentWrite, {},
+		  vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		  vk::PipelineStageFlagBits2::eBottomOfPipe);
+	  }
+	  gpuProfiler.endPass(commandBuffers[currentFrame], currentFrame,
+						  GpuPass::PresentTransition);
 	  commandBuffers[currentFrame].end();
 	}
 
@@ -1382,11 +3987,21 @@ class HelloTriangleApplication {
 	}
 
 	void drawFrame() {
+	  frameStats.beginFrame();
 
 	  while (vk::Result::eTimeout ==
 			 device.waitForFences(*inFlightFences[currentFrame], vk::True,
 								  UINT64_MAX))
 		;
+	  frameStats.lap(FramePhase::FenceWait);
+	  collectGpuTimings();
+	  collectCullStats();
+	  updateAssets();
+
+	  if (options.headless) {
+		drawOffscreenFrame();
+		return;
+	  }
 
 	  auto [result, imageIndex] = SwapchainNextImageWrapper(
 		swapChain, UINT64_MAX, *presentCompleteSemaphores[semaphoreIndex],
@@ -1400,6 +4015,7 @@ class HelloTriangleApplication {
 		  result != vk::Result::eSuboptimalKHR) {
 		throw std::runtime_error("failed to acquire swap chain image!");
 	  }
+	  frameStats.lap(FramePhase::Acquire);
 
 	  vk::Result waitResult = vk::Result::eSuccess;
 	  if (imagesInFlight[imageIndex]) {
@@ -1410,10 +4026,13 @@ class HelloTriangleApplication {
 	  if (waitResult != vk::Result::eSuccess) {
 		throw std::runtime_error("failed to get fence");
 	  }
+	  frameStats.lap(FramePhase::FenceWait);
+
 	  updateUniformBuffer(currentFrame);
+	  frameStats.lap(FramePhase::UpdateUniforms);
 
-	  commandBuffers[currentFrame].reset();
-	  recordCommandBuffer(imageIndex);
+	  prepareFrameCommands(imageIndex);
+	  frameStats.lap(FramePhase::Record);
 
 	  device.resetFences(*inFlightFences[currentFrame]);
 
@@ -1430,6 +4049,8 @@ class HelloTriangleApplication {
 		.signalSemaphoreCount = 1,
 		.pSignalSemaphores = &*renderFinishedSemaphores[semaphoreIndex]};
 	  graphicsQueue.submit(submitInfo, *inFlightFences[currentFrame]);
+	  releaseFrameCommands(imageIndex);
+	  frameStats.lap(FramePhase::Submit);
 
 	  const vk::PresentInfoKHR presentInfoKHR{
 		.waitSemaphoreCount = 1,
@@ -1439,6 +4060,7 @@ class HelloTriangleApplication {
 		.pImageIndices = &imageIndex};
 	  vk::Result presentResult =
 		QueuePresentWrapper(graphicsQueue, presentInfoKHR);
+	  frameStats.lap(FramePhase::Present);
 	  if (presentResult == vk::Result::eErrorOutOfDateKHR ||
 		  presentResult == vk::Result::eSuboptimalKHR ||
 		  framebufferResized) {
@@ -1449,33 +4071,158 @@ class HelloTriangleApplication {
 	  }
 	  semaphoreIndex = (semaphoreIndex + 1) % swapChainImages.size();
 	  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	  frameNumber++;
+	  frameStats.endFrame();
 	}
 
-	void updateUniformBuffer(uint32_t currentImage) {
-	  static auto startTime = std::chrono::high_resolution_clock::now();
+	// Headless counterpart of the acquire/submit/present sequence above. There
+	// is nothing to acquire or present, so the in-flight fence is the only
+	// synchronisation and each frame slot owns its offscreen target.
+	void drawOffscreenFrame() {
+	  uint32_t imageIndex = currentFrame;
+
+	  updateUniformBuffer(currentFrame);
+	  frameStats.lap(FramePhase::UpdateUniforms);
+
+	  prepareFrameCommands(imageIndex);
+	  frameStats.lap(FramePhase::Record);
+
+	  device.resetFences(*inFlightFences[currentFrame]);
+
+	  const vk::SubmitInfo submitInfo{
+		.commandBufferCount = 1,
+		.pCommandBuffers = &*commandBuffers[currentFrame]};
+	  graphicsQueue.submit(submitInfo, *inFlightFences[currentFrame]);
+	  releaseFrameCommands(imageIndex);
+	  frameStats.lap(FramePhase::Submit);
 
-	  auto currentTime = std::chrono::high_resolution_clock::now();
-	  float time =
-		std::chrono::duration<float, std::chrono::seconds::period>(
-		  currentTime - startTime)
-		  .count();
+	  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	  frameNumber++;
+	  frameStats.endFrame();
+	}
+
+	// Reads back the queries of the frame slot about to be reused. Its fence
+	// has signalled, so the results are ready without waiting.
+	void collectGpuTimings() {
+	  auto report = gpuProfiler.collect(currentFrame, swapChainExtent);
+	  if (!report) {
+		return;
+	  }
+	  for (size_t pass = 0; pass < report->passMs.size(); pass++) {
+		frameStats.recordMetric(GPU_PASS_NAMES[pass], report->passMs[pass]);
+	  }
+	  frameStats.recordMetric("gpu_frame", report->totalMs);
+
+	  if (options.benchmarkFrames > 0 ||
+		  frameNumber % GPU_PROFILE_LOG_INTERVAL != 0) {
+		return;
+	  }
+	  std::cout << "GPU: cull " << report->passMs[0] << " ms, barriers "
+				<< report->passMs[1] << " ms, draw " << report->passMs[2]
+				<< " ms, occlusion " << report->passMs[3] << " ms, late draw "
+				<< report->passMs[4] << " ms, resolve " << report->passMs[5]
+				<< " ms, present transition " << report->passMs[6]
+				<< " ms, total " << report->totalMs << " ms";
+	  if (report->hasStatistics) {
+		std::cout << " | vertex invocations " << report->vertexInvocations
+				  << ", clipping primitives " << report->clippingPrimitives
+				  << ", fragment invocations " << report->fragmentInvocations
+				  << ", overdraw " << report->overdraw;
+	  }
+	  std::cout << std::endl;
+	}
+
+	// Benchmarks advance a fixed step per frame so every run sees the same
+	// sequence of frames regardless of how fast they render.
+	float animationTime() const {
+	  if (options.benchmarkFrames > 0) {
+		return static_cast<float>(frameNumber) * BENCHMARK_FRAME_TIME;
+	  }
+	  return std::chrono::duration<float, std::chrono::seconds::period>(
+			   std::chrono::steady_clock::now() - animationStartTime)
+		.count();
+	}
+
+	// What the camera distance and the near and far planes are scaled by: 1
+	// for the single model, the grid's reach with more instances, so the
+	// whole grid stays in view and in front of the far plane.
+	float viewScale() const {
+	  return instanceCount > 1 ? instanceGridReach(instanceCount) : 1.0f;
+	}
+
+	// Benchmark camera: a slow orbit that bobs up and down, so the run covers
+	// close-ups as well as the whole model. Scaled by viewScale().
+	glm::vec3 cameraPosition(float time) const {
+	  if (options.benchmarkFrames == 0) {
+		return glm::vec3(2.0f, 2.0f, 2.0f) * viewScale();
+	  }
+	  float angle = time * glm::radians(20.0f);
+	  float radius = 2.5f + 0.75f * std::sin(time * 0.4f);
+	  return glm::vec3(radius * std::cos(angle), radius * std::sin(angle),
+					   1.5f + 0.75f * std::sin(time * 0.25f)) *
+			 viewScale();
+	}
+
+	// Level of detail of an instance at position, by this frame's choices
+	uint32_t instanceLod(glm::vec3 position) const {
+	  return selectLod(std::span<const MeshLod>(mesh.lods.data(), lodCount),
+					   glm::distance(lodEye, position) - lodReach, lodScale);
+	}
+
+	// Distance from which an error of one model unit projects to
+	// options.lodErrorPixels: proj[1][1] scales tangents to half the height of
+	// the viewport.
+	float lodDistanceScale(const glm::mat4 &proj) const {
+	  if (options.lodErrorPixels <= 0.0f) {
+		return 0.0f;
+	  }
+	  return std::abs(proj[1][1]) * 0.5f *
+			 static_cast<float>(swapChainExtent.height) /
+			 options.lodErrorPixels;
+	}
+
+	void updateUniformBuffer(uint32_t currentImage) {
+	  float time = animationTime();
 
 	  UniformBufferObject ubo{};
 	  ubo.model = rotate(glm::mat4(1.0f), time * glm::radians(90.0f),
-						 glm::vec3(0.0f, 0.0f, 1.0f));
+						 glm::vec3(0.0f, 0.0f, 1.0f)) *
+				  mesh.dequantize;
 
 	  ubo.view =
-		lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f),
+		lookAt(cameraPosition(time), glm::vec3(0.0f, 0.0f, 0.0f),
 			   glm::vec3(0.0f, 0.0f, 1.0f));
 
+	  // The camera stays within 4.5 view scales of the origin and the
+	  // instances within one
+	  float scale = viewScale();
 	  ubo.proj =
 		glm::perspective(glm::radians(45.0f),
 						 static_cast<float>(swapChainExtent.width) /
 						   static_cast<float>(swapChainExtent.height),
-						 0.1f, 10.0f);
+						 0.1f * scale, 10.0f * scale);
 
 	  ubo.proj[1][1] *= -1;
+
+	  lodCount = options.lodErrorPixels > 0.0f
+				   ? static_cast<uint32_t>(
+					   std::min<size_t>(mesh.lods.size(), MAX_MESH_LODS))
+				   : 1u;
+	  lodScale = lodDistanceScale(ubo.proj);
+	  std::copy_n(mesh.lods.begin(), lodCount, ubo.lods);
+	  ubo.lodCount = lodCount;
+	  ubo.lodDistanceScale = lodScale;
+	  // Direct draws share one level, the one the nearest instance needs. An
+	  // instance's bounding sphere is somewhere around its position, no
+	  // farther than the offset of the center.
+	  lodEye = cameraPosition(time);
+	  glm::vec3 center =
+		glm::vec3(ubo.model * glm::vec4(glm::vec3(mesh.boundingSphere), 1.0f));
+	  lodReach = glm::length(center) + mesh.boundingSphere.w;
+	  directLod = instanceLod(nearestInstancePosition(lodEye, instanceCount));
+
 	  memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+	  updateInstanceBuffer(currentImage);
 	}
 
 	vk::Result QueuePresentWrapper(const vk::raii::Queue &queue,
@@ -1540,6 +4287,10 @@ class HelloTriangleApplication {
 	  createImageViews();
 	  createColorResources();
 	  createDepthResource();
+	  if (options.occlusionCulling) {
+		createDepthPyramid();
+	  }
+	  createCachedCommandBuffers();
 	}
 
 	static void frameBufferResizeCallback(GLFWwindow *window, int /*width*/,
@@ -1549,22 +4300,6 @@ class HelloTriangleApplication {
 	  app->framebufferResized = true;
 	}
 
-	uint32_t findMemoryType(uint32_t typeFilter,
-							vk::MemoryPropertyFlags properties) {
-	  vk::PhysicalDeviceMemoryProperties memProperties =
-		physicalDevice.getMemoryProperties();
-
-	  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) &&
-			(memProperties.memoryTypes[i].propertyFlags & properties) ==
-			  properties) {
-		  return i;
-		}
-	  }
-
-	  throw std::runtime_error("failed to find suitable memory type!");
-	}
-
 	[[nodiscard]] vk::raii::ShaderModule
 	createShaderModule(const std::vector<char> &code) const {
 	  vk::ShaderModuleCreateInfo createInfo{
@@ -1632,10 +4367,427 @@ class HelloTriangleApplication {
         }
 	};
 
-int main() {
-  HelloTriangleApplication app;
+// Face corners of an OBJ before welding, read with tinyobj as loadModel() did
+// before parseObj(). Used as the reference in benchmarks.
+std::vector<Vertex> loadObjCorners(const std::string &path) {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::vector<tinyobj::material_t> materials;
+  std::string warn, err;
+  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
+                        path.c_str())) {
+    throw std::runtime_error(warn + err);
+  }
+
+  std::vector<Vertex> corners;
+  for (const auto &shape : shapes) {
+    for (const auto &index : shape.mesh.indices) {
+      Vertex vertex{};
+      vertex.pos = {attrib.vertices[3 * index.vertex_index + 0],
+                    attrib.vertices[3 * index.vertex_index + 1],
+                    attrib.vertices[3 * index.vertex_index + 2]};
+      if (index.texcoord_index >= 0) {
+        vertex.texCoord = {
+          attrib.texcoords[2 * index.texcoord_index + 0],
+          1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+      }
+      vertex.color = {1.0f, 1.0f, 1.0f};
+      corners.push_back(vertex);
+    }
+  }
+  return corners;
+}
+
+// A square grid of at least triangleCount triangles, unwelded: every vertex is
+// repeated once per triangle that uses it, as in an OBJ.
+std::vector<Vertex> makeGridCorners(uint32_t triangleCount) {
+  auto quadsPerSide = static_cast<uint32_t>(
+    std::ceil(std::sqrt(static_cast<double>(triangleCount) / 2.0)));
+  auto gridVertex = [quadsPerSide](uint32_t x, uint32_t y) {
+    float u = static_cast<float>(x) / static_cast<float>(quadsPerSide);
+    float v = static_cast<float>(y) / static_cast<float>(quadsPerSide);
+    return Vertex{{u, v, 0.0f}, {1.0f, 1.0f, 1.0f}, {u, v}};
+  };
+
+  constexpr std::array<std::pair<uint32_t, uint32_t>, 6> quadCorners = {
+    {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}}};
+
+  std::vector<Vertex> corners;
+  corners.reserve(static_cast<size_t>(quadsPerSide) * quadsPerSide * 6);
+  for (uint32_t y = 0; y < quadsPerSide; y++) {
+    for (uint32_t x = 0; x < quadsPerSide; x++) {
+      for (auto [dx, dy] : quadCorners) {
+        corners.push_back(gridVertex(x + dx, y + dy));
+      }
+    }
+  }
+  return corners;
+}
+
+// The welding loop loadModel() used before VertexWeldTable, kept as the
+// benchmark reference.
+void weldWithUnorderedMap(const std::vector<Vertex> &corners,
+                          std::vector<Vertex> &vertices,
+                          std::vector<uint32_t> &indices) {
+  std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+  for (const auto &vertex : corners) {
+    if (uniqueVertices.count(vertex) == 0) {
+      uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(vertex);
+    }
+    indices.push_back(uniqueVertices[vertex]);
+  }
+}
+
+void weldWithTable(const std::vector<Vertex> &corners,
+                   std::vector<Vertex> &vertices,
+                   std::vector<uint32_t> &indices) {
+  indices.reserve(corners.size());
+  VertexWeldTable<Vertex, VertexHash> uniqueVertices(vertices, corners.size());
+  for (const auto &vertex : corners) {
+    indices.push_back(uniqueVertices.insert(vertex));
+  }
+}
+
+void benchmarkWeld(const std::string &name,
+                   const std::vector<Vertex> &corners) {
+  constexpr int RUNS = 5;
+  auto bestOf = [&corners](auto weld, std::vector<Vertex> &vertices,
+                           std::vector<uint32_t> &indices) {
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < RUNS; run++) {
+      vertices.clear();
+      indices.clear();
+      vertices.shrink_to_fit();
+      indices.shrink_to_fit();
+      auto start = std::chrono::steady_clock::now();
+      weld(corners, vertices, indices);
+      best = std::min(best, std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+    }
+    return best;
+  };
+
+  std::vector<Vertex> mapVertices, tableVertices;
+  std::vector<uint32_t> mapIndices, tableIndices;
+  double mapMs = bestOf(weldWithUnorderedMap, mapVertices, mapIndices);
+  double tableMs = bestOf(weldWithTable, tableVertices, tableIndices);
+  if (mapVertices != tableVertices || mapIndices != tableIndices) {
+    throw std::runtime_error("weld table output differs for " + name);
+  }
+
+  std::cout << name << ": " << corners.size() << " corners -> "
+            << tableVertices.size() << " vertices, unordered_map " << mapMs
+            << " ms, weld table " << tableMs << " ms (" << mapMs / tableMs
+            << "x)" << std::endl;
+}
+
+void runWeldBenchmark(const AppOptions &options) {
+  benchmarkWeld(MODEL_PATH, loadObjCorners(MODEL_PATH));
+  benchmarkWeld("synthetic grid", makeGridCorners(options.syntheticTriangles));
+}
+
+// Face corners of parsed that differ from tinyobj's, bit for bit, or all of
+// them when the counts differ. Welding is deterministic, so equal corners
+// make equal vertices and indices.
+size_t countTinyobjMismatches(const std::vector<Vertex> &tinyobjCorners,
+                              const ObjData &parsed) {
+  if (tinyobjCorners.size() != parsed.corners.size()) {
+    return std::max(tinyobjCorners.size(), parsed.corners.size());
+  }
+  size_t mismatches = 0;
+  for (size_t i = 0; i < tinyobjCorners.size(); i++) {
+    if (!(tinyobjCorners[i] == makeObjVertex(parsed, parsed.corners[i]))) {
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+// Fails unless parseObj() reads the file into the same corners as tinyobj,
+// which loadModel() used before it.
+void checkObjAgainstTinyobj(const std::string &path,
+                            const std::vector<Vertex> &tinyobjCorners,
+                            const ObjData &parsed) {
+  size_t mismatches = countTinyobjMismatches(tinyobjCorners, parsed);
+  if (mismatches > 0) {
+    throw std::runtime_error(path + ": " + std::to_string(mismatches) +
+                             " face corners differ from tinyobj");
+  }
+}
+
+// Parses the file with tinyobj and with parseObj() on 1, 2, 4, ... threads.
+// The single-threaded run has to match tinyobj, on the file and on the
+// bundled model, and every thread count the single-threaded run.
+void runObjBenchmark(const AppOptions &options) {
+  MappedFile source(options.benchObjPath);
+  if (!source.isOpen()) {
+    throw std::runtime_error("failed to open " + options.benchObjPath);
+  }
+  const auto *text = reinterpret_cast<const char *>(source.data());
+  auto elapsedMs = [](auto start) {
+    return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Vertex> tinyobjCorners = loadObjCorners(options.benchObjPath);
+  double tinyobjMs = elapsedMs(start);
+
+  start = std::chrono::steady_clock::now();
+  ObjData reference = parseObj(text, source.size(), nullptr);
+  double serialMs = elapsedMs(start);
+
+  checkObjAgainstTinyobj(options.benchObjPath, tinyobjCorners, reference);
+  if (options.benchObjPath != MODEL_PATH) {
+    MappedFile model(MODEL_PATH);
+    if (!model.isOpen()) {
+      throw std::runtime_error("failed to open " + MODEL_PATH);
+    }
+    checkObjAgainstTinyobj(
+      MODEL_PATH, loadObjCorners(MODEL_PATH),
+      parseObj(reinterpret_cast<const char *>(model.data()), model.size(),
+               nullptr));
+  }
+  std::cout << options.benchObjPath << ": " << source.size() << " bytes, "
+            << reference.corners.size() / 3 << " triangles\n"
+            << "tinyobj: " << tinyobjMs << " ms\n"
+            << "1 thread: " << serialMs << " ms (matches tinyobj)" << std::endl;
+
+  unsigned maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned threads = 2; threads <= maxThreads; threads *= 2) {
+    ThreadPool pool(threads);
+    start = std::chrono::steady_clock::now();
+    ObjData parsed = parseObj(text, source.size(), &pool);
+    double parallelMs = elapsedMs(start);
+    bool identical =
+      parsed.positions == reference.positions &&
+      parsed.texcoords == reference.texcoords &&
+      std::equal(parsed.corners.begin(), parsed.corners.end(),
+                 reference.corners.begin(), reference.corners.end(),
+                 [](const ObjCorner &a, const ObjCorner &b) {
+                   return a.position == b.position && a.texcoord == b.texcoord;
+                 });
+    if (!identical) {
+      throw std::runtime_error("parallel OBJ parse differs from 1 thread");
+    }
+    std::cout << threads << " threads: " << parallelMs << " ms ("
+              << serialMs / parallelMs << "x)" << std::endl;
+  }
+}
+
+// Generates the mip chain of TEXTURE_PATH with every kernel the CPU supports,
+// on one thread and on the worker pool. Every run has to match the scalar
+// kernel on one thread.
+void runMipBenchmark() {
+  constexpr int RUNS = 5;
+  ImagePixels image = loadImagePixels(TEXTURE_PATH);
+  const auto *pixels = image.pixels.get();
+  MipChainLayout layout = mipChainLayout(image.width, image.height);
+
+  std::vector<uint8_t> reference(layout.totalSize);
+  generateMipChain(pixels, layout, reference.data(), nullptr,
+                   MipKernel::Scalar);
+  auto matchesReference = [&](const std::vector<uint8_t> &chain) {
+    return std::all_of(
+      layout.levels.begin(), layout.levels.end(), [&](const auto &level) {
+        return std::memcmp(chain.data() + level.offset,
+                           reference.data() + level.offset, level.size) == 0;
+      });
+  };
+
+  std::cout << TEXTURE_PATH << ": " << image.width << "x" << image.height
+            << ", " << layout.levels.size() << " levels" << std::endl;
+  ThreadPool pool;
+  double scalarMs = 0;
+  for (MipKernel kernel :
+       {MipKernel::Scalar, MipKernel::Sse2, MipKernel::Avx2}) {
+    if (!mipKernelSupported(kernel)) {
+      continue;
+    }
+    for (ThreadPool *threads : {static_cast<ThreadPool *>(nullptr), &pool}) {
+      std::vector<uint8_t> chain(layout.totalSize);
+      double best = std::numeric_limits<double>::max();
+      for (int run = 0; run < RUNS; run++) {
+        auto start = std::chrono::steady_clock::now();
+        generateMipChain(pixels, layout, chain.data(), threads, kernel);
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+      }
+      if (!matchesReference(chain)) {
+        throw std::runtime_error(std::string(mipKernelName(kernel)) +
+                                 " mip kernel differs from scalar");
+      }
+      if (scalarMs == 0) {
+        scalarMs = best;
+      }
+      std::cout << mipKernelName(kernel) << ", "
+                << (threads ? threads->size() + 1 : 1) << " threads: " << best
+                << " ms (" << scalarMs / best << "x)" << std::endl;
+    }
+  }
+}
+
+// Bakes an image into a BC7 KTX2 file with its full mip chain. Mips are
+// filtered in linear space before encoding.
+void runTextureBake(const AppOptions &options) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile source(options.bakeTextureInput);
+  if (!source.isOpen()) {
+    throw std::runtime_error("failed to open " + options.bakeTextureInput);
+  }
+  ImagePixels image = loadImagePixels(options.bakeTextureInput);
+  MipChainLayout layout = mipChainLayout(image.width, image.height);
+  std::vector<uint8_t> chain(layout.totalSize);
+
+  ThreadPool pool;
+  generateMipChain(image.pixels.get(), layout, chain.data(), &pool);
+  std::vector<std::vector<uint8_t>> levels;
+  size_t compressedBytes = 0;
+  size_t uncompressedBytes = 0;
+  for (const auto &level : layout.levels) {
+    levels.push_back(encodeBc7(chain.data() + level.offset, level.width,
+                               level.height, &pool));
+    compressedBytes += levels.back().size();
+    uncompressedBytes += level.size;
+  }
+  double psnr =
+    measureBc7Psnr(chain.data(), image.width, image.height, levels[0]);
+  double bakeMs = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+  if (!writeKtx2(options.bakeTextureOutput, Ktx2Format::Bc7SrgbBlock,
+                 image.width, image.height, levels,
+                 textureBakeHash(source))) {
+    throw std::runtime_error("failed to write " + options.bakeTextureOutput);
+  }
+  std::cout << options.bakeTextureOutput << ": " << image.width << "x"
+            << image.height << " BC7, " << levels.size() << " levels, "
+            << compressedBytes / 1024 << " KiB (RGBA8 "
+            << uncompressedBytes / 1024 << " KiB), PSNR " << psnr
+            << " dB, baked in " << bakeMs << " ms" << std::endl;
+}
 
+AppOptions parseOptions(int argc, char **argv) {
+  AppOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      options.frameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--benchmark" && i + 1 < argc) {
+      options.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--benchmark-out" && i + 1 < argc) {
+      options.benchmarkOutput = argv[++i];
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      options.benchmarkBaseline = argv[++i];
+    } else if (arg == "--tolerance" && i + 1 < argc) {
+      options.benchmarkTolerance = std::stod(argv[++i]);
+    } else if (arg == "--gpu-profile") {
+      options.gpuProfile = true;
+    } else if (arg == "--packed-vertices") {
+      options.packedVertices = true;
+    } else if (arg == "--memory-stats") {
+      options.memoryStats = true;
+    } else if (arg == "--no-upload-batching") {
+      options.uploadBatching = false;
+    } else if (arg == "--no-ktx2") {
+      options.noKtx2 = true;
+    } else if (arg == "--no-pipeline-cache") {
+      options.pipelineCache = false;
+    } else if (arg == "--bake-texture" && i + 2 < argc) {
+      options.bakeTextureInput = argv[++i];
+      options.bakeTextureOutput = argv[++i];
+    } else if (arg == "--mip-mode" && i + 1 < argc) {
+      std::string_view mode = argv[++i];
+      if (mode == "blit") {
+        options.mipMode = MipMode::Blit;
+      } else if (mode == "cpu") {
+        options.mipMode = MipMode::Cpu;
+      } else if (mode == "compute") {
+        options.mipMode = MipMode::Compute;
+      } else {
+        throw std::runtime_error("unknown mip mode: " + std::string(mode));
+      }
+    } else if (arg == "--bench-mips") {
+      options.benchMips = true;
+    } else if (arg == "--instances" && i + 1 < argc) {
+      options.instances = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--bench-instances") {
+      options.benchInstances = true;
+    } else if (arg == "--gpu-culling") {
+      options.gpuCulling = true;
+    } else if (arg == "--occlusion-culling") {
+      options.gpuCulling = true;
+      options.occlusionCulling = true;
+    } else if (arg == "--lod-error" && i + 1 < argc) {
+      options.lodErrorPixels = std::stof(argv[++i]);
+    } else if (arg == "--record-threads" && i + 1 < argc) {
+      options.recordThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--cached-commands") {
+      options.cachedCommands = true;
+    } else if (arg == "--meshlet-culling") {
+      options.gpuCulling = true;
+      options.meshletCulling = true;
+    } else if (arg == "--bench-weld") {
+      options.benchWeld = true;
+    } else if (arg == "--bench-obj" && i + 1 < argc) {
+      options.benchObjPath = argv[++i];
+    } else if (arg == "--synthetic-triangles" && i + 1 < argc) {
+      options.syntheticTriangles =
+        static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else {
+      throw std::runtime_error("unknown argument: " + std::string(arg));
+    }
+  }
+  if (options.meshletCulling && options.occlusionCulling) {
+    throw std::runtime_error(
+      "--meshlet-culling and --occlusion-culling do not combine");
+  }
+  if (options.recordThreads > 0 && options.gpuCulling) {
+    throw std::runtime_error(
+      "--record-threads does not combine with GPU culling");
+  }
+  if (options.cachedCommands && options.recordThreads > 0) {
+    throw std::runtime_error(
+      "--cached-commands does not combine with --record-threads");
+  }
+  return options;
+}
+
+int main(int argc, char **argv) {
   try {
+    AppOptions options = parseOptions(argc, argv);
+    if (options.benchWeld) {
+      runWeldBenchmark(options);
+      return EXIT_SUCCESS;
+    }
+    if (!options.benchObjPath.empty()) {
+      runObjBenchmark(options);
+      return EXIT_SUCCESS;
+    }
+    if (!options.bakeTextureInput.empty()) {
+      runTextureBake(options);
+      return EXIT_SUCCESS;
+    }
+    if (options.benchMips) {
+      runMipBenchmark();
+      options.headless = true;
+    }
+    if (options.benchInstances) {
+      // GPU frame times come from the profiler, and the fixed timestep of
+      // benchmarks keeps the sweep repeatable
+      options.gpuProfile = true;
+      if (options.benchmarkFrames == 0) {
+        options.benchmarkFrames = 300;
+      }
+    }
+    HelloTriangleApplication app(options);
     app.run();
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
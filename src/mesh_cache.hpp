@@ -0,0 +1,143 @@
+#pragma once
+
+#include "file_io.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+// Bump whenever the meaning of cached data changes, so stale caches rebuild.
+constexpr uint32_t MESH_CACHE_VERSION = 7;
+constexpr char MESH_CACHE_MAGIC[8] = {'H', 'V', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+enum class MeshSection : uint32_t {
+  Vertices = 1,
+  Indices = 2,
+  Meshlets = 3,
+  Lods = 4,
+};
+
+// File layout: header, section table, then each section's elements starting
+// at a 16 byte aligned offset so they can be used in place once mapped.
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sectionCount;
+  uint64_t sourceHash;
+};
+
+struct MeshCacheSection {
+  uint32_t id;
+  uint32_t elementSize;
+  uint64_t offset;
+  uint64_t count;
+};
+
+class MeshCache {
+public:
+  struct SectionData {
+    MeshSection id;
+    uint32_t elementSize;
+    const void *data;
+    uint64_t count;
+  };
+
+  template <typename T>
+  static SectionData makeSection(MeshSection id, std::span<const T> elements) {
+    return {id, static_cast<uint32_t>(sizeof(T)), elements.data(),
+            elements.size()};
+  }
+
+  // Maps the cache at path. Fails when it is missing, malformed, written by a
+  // different MESH_CACHE_VERSION or built from a different source.
+  bool open(const std::string &path, uint64_t sourceHash) {
+    if (!file.open(path) || file.size() < sizeof(MeshCacheHeader)) {
+      file.close();
+      return false;
+    }
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    size_t tableEnd = sizeof(MeshCacheHeader) +
+                      header.sectionCount * sizeof(MeshCacheSection);
+    if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+        header.version != MESH_CACHE_VERSION ||
+        header.sourceHash != sourceHash || tableEnd > file.size()) {
+      file.close();
+      return false;
+    }
+    sections.resize(header.sectionCount);
+    std::memcpy(sections.data(), file.data() + sizeof(MeshCacheHeader),
+                sections.size() * sizeof(MeshCacheSection));
+    // Divides rather than multiplies, so no count or offset can wrap around
+    for (const auto &section : sections) {
+      if (section.offset > file.size() ||
+          (section.elementSize != 0 &&
+           section.count > (file.size() - section.offset) /
+                             section.elementSize)) {
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    file.close();
+    sections.clear();
+  }
+
+  bool isOpen() const { return file.isOpen(); }
+
+  // Elements of a section, empty when it is absent or its element size does
+  // not match T.
+  template <typename T> std::span<const T> section(MeshSection id) const {
+    for (const auto &entry : sections) {
+      if (entry.id == static_cast<uint32_t>(id) &&
+          entry.elementSize == sizeof(T) && entry.offset % alignof(T) == 0) {
+        return {reinterpret_cast<const T *>(file.data() + entry.offset),
+                static_cast<size_t>(entry.count)};
+      }
+    }
+    return {};
+  }
+
+  static bool write(const std::string &path, uint64_t sourceHash,
+                    const std::vector<SectionData> &data) {
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.sectionCount = static_cast<uint32_t>(data.size());
+    header.sourceHash = sourceHash;
+
+    std::vector<MeshCacheSection> table;
+    uint64_t offset = alignOffset(sizeof(MeshCacheHeader) +
+                                  data.size() * sizeof(MeshCacheSection));
+    for (const auto &section : data) {
+      table.push_back({static_cast<uint32_t>(section.id), section.elementSize,
+                       offset, section.count});
+      offset = alignOffset(offset + section.count * section.elementSize);
+    }
+
+    std::vector<std::byte> bytes(offset);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), table.data(),
+                table.size() * sizeof(MeshCacheSection));
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i].count > 0) {
+        std::memcpy(bytes.data() + table[i].offset, data[i].data,
+                    data[i].count * data[i].elementSize);
+      }
+    }
+    return writeFileAtomic(path, bytes.data(), bytes.size());
+  }
+
+private:
+  MappedFile file;
+  std::vector<MeshCacheSection> sections;
+
+  static uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~15ull; }
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Post-transform cache size the optimizations target and the statistics
+// simulate. Hardware varies; 16 entries is a common, conservative choice.
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+using MeshPosition = std::array<float, 3>;
+
+struct VertexCacheStats {
+  // Average cache miss ratio: transformed vertices per triangle, 0.5 to 3
+  double acmr = 0.0;
+  // Average transform to vertex ratio: transformed vertices per unique
+  // vertex, 1 is optimal
+  double atvr = 0.0;
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries over indices.
+inline VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices,
+                                           size_t vertexCount,
+                                           uint32_t cacheSize = VERTEX_CACHE_SIZE) {
+  // A vertex is in the cache while fewer than cacheSize misses happened since
+  // its own miss
+  std::vector<uint64_t> missTime(vertexCount, 0);
+  uint64_t misses = 0;
+  for (uint32_t index : indices) {
+    if (missTime[index] == 0 || misses - missTime[index] >= cacheSize) {
+      misses++;
+      missTime[index] = misses;
+    }
+  }
+  VertexCacheStats stats;
+  if (!indices.empty()) {
+    stats.acmr = static_cast<double>(misses) / (indices.size() / 3);
+  }
+  if (vertexCount > 0) {
+    stats.atvr = static_cast<double>(misses) / vertexCount;
+  }
+  return stats;
+}
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw", 2007). Emits triangles by fanning around a
+// vertex that is likely still in the cache. When the fan runs out of cached
+// candidates it jumps elsewhere in the mesh. Those jumps start a new cluster,
+// and so does a fan once the cache has turned over since its cluster began,
+// which keeps clusters small enough for optimizeOverdraw() to sort. The first
+// triangle of each cluster is returned in clusterStarts.
+inline std::vector<uint32_t>
+optimizeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount,
+                    std::vector<uint32_t> &clusterStarts,
+                    uint32_t cacheSize = VERTEX_CACHE_SIZE) {
+  size_t triangleCount = indices.size() / 3;
+
+  // Triangles around each vertex, as offsets into adjacency
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices) {
+    liveTriangles[index]++;
+  }
+  std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; v++) {
+    adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffset.begin(),
+                               adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<uint64_t> cacheTime(vertexCount, 0);
+  uint64_t timestamp = cacheSize + 1;
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  size_t cursor = 0;
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  clusterStarts.clear();
+
+  auto skipDeadEnd = [&]() -> int64_t {
+    while (!deadEnd.empty()) {
+      uint32_t vertex = deadEnd.back();
+      deadEnd.pop_back();
+      if (liveTriangles[vertex] > 0) {
+        return vertex;
+      }
+    }
+    for (; cursor < vertexCount; cursor++) {
+      if (liveTriangles[cursor] > 0) {
+        return static_cast<int64_t>(cursor);
+      }
+    }
+    return -1;
+  };
+
+  int64_t fanning = skipDeadEnd();
+  bool newCluster = true;
+  uint64_t clusterTimestamp = timestamp;
+  while (fanning >= 0) {
+    if (newCluster || timestamp - clusterTimestamp >= cacheSize) {
+      clusterStarts.push_back(static_cast<uint32_t>(result.size() / 3));
+      clusterTimestamp = timestamp;
+    }
+    candidates.clear();
+    for (uint32_t a = adjacencyOffset[fanning];
+         a < adjacencyOffset[fanning + 1]; a++) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle]) {
+        continue;
+      }
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t vertex = indices[triangle * 3 + corner];
+        result.push_back(vertex);
+        deadEnd.push_back(vertex);
+        candidates.push_back(vertex);
+        liveTriangles[vertex]--;
+        if (timestamp - cacheTime[vertex] > cacheSize) {
+          cacheTime[vertex] = timestamp++;
+        }
+      }
+      emitted[triangle] = true;
+    }
+
+    // Prefer the candidate that stays in the cache while its remaining
+    // triangles are emitted, and among those the oldest. A candidate that
+    // would not is no better than one from the dead-end stack.
+    int64_t best = -1;
+    int64_t bestPriority = 0;
+    for (uint32_t vertex : candidates) {
+      if (liveTriangles[vertex] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      if (timestamp - cacheTime[vertex] + 2 * liveTriangles[vertex] <=
+          cacheSize) {
+        priority = static_cast<int64_t>(timestamp - cacheTime[vertex]);
+      }
+      if (priority > bestPriority) {
+        best = vertex;
+        bestPriority = priority;
+      }
+    }
+    newCluster = best < 0;
+    fanning = newCluster ? skipDeadEnd() : best;
+  }
+  return result;
+}
+
+// Reorders the clusters found by optimizeVertexCache() so that those facing
+// away from the mesh centre, which tend to occlude the rest, are drawn first
+// (the sort from the same paper). Triangle order within a cluster, and with it
+// most of the cache locality, is kept.
+inline std::vector<uint32_t>
+optimizeOverdraw(const std::vector<uint32_t> &indices,
+                 const std::vector<MeshPosition> &positions,
+                 const std::vector<uint32_t> &clusterStarts) {
+  size_t triangleCount = indices.size() / 3;
+  size_t clusterCount = clusterStarts.size();
+  if (clusterCount < 2) {
+    return indices;
+  }
+
+  // Area weighted centroid and normal of the mesh and of every cluster
+  std::array<double, 3> meshCentroid{};
+  double meshArea = 0.0;
+  std::vector<std::array<double, 3>> centroids(clusterCount);
+  std::vector<std::array<double, 3>> normals(clusterCount);
+  std::vector<double> areas(clusterCount, 0.0);
+  for (size_t c = 0; c < clusterCount; c++) {
+    size_t end = c + 1 < clusterCount ? clusterStarts[c + 1] : triangleCount;
+    for (size_t t = clusterStarts[c]; t < end; t++) {
+      const MeshPosition &a = positions[indices[t * 3 + 0]];
+      const MeshPosition &b = positions[indices[t * 3 + 1]];
+      const MeshPosition &p = positions[indices[t * 3 + 2]];
+      std::array<double, 3> e1{b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      std::array<double, 3> e2{p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+      std::array<double, 3> normal{e1[1] * e2[2] - e1[2] * e2[1],
+                                   e1[2] * e2[0] - e1[0] * e2[2],
+                                   e1[0] * e2[1] - e1[1] * e2[0]};
+      double area = 0.5 * std::sqrt(normal[0] * normal[0] +
+                                    normal[1] * normal[1] +
+                                    normal[2] * normal[2]);
+      for (int i = 0; i < 3; i++) {
+        double centre = (a[i] + b[i] + p[i]) / 3.0;
+        centroids[c][i] += centre * area;
+        normals[c][i] += normal[i];
+        meshCentroid[i] += centre * area;
+      }
+      areas[c] += area;
+      meshArea += area;
+    }
+  }
+  if (meshArea <= 0.0) {
+    return indices;
+  }
+
+  std::vector<double> sortKey(clusterCount, 0.0);
+  for (size_t c = 0; c < clusterCount; c++) {
+    if (areas[c] <= 0.0) {
+      continue;
+    }
+    double length = std::sqrt(normals[c][0] * normals[c][0] +
+                              normals[c][1] * normals[c][1] +
+                              normals[c][2] * normals[c][2]);
+    for (int i = 0; i < 3 && length > 0.0; i++) {
+      double offset = centroids[c][i] / areas[c] - meshCentroid[i] / meshArea;
+      sortKey[c] += offset * normals[c][i] / length;
+    }
+  }
+
+  std::vector<uint32_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sortKey[a] > sortKey[b];
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (uint32_t c : order) {
+    size_t end = c + 1 < clusterCount ? clusterStarts[c + 1] : triangleCount;
+    result.insert(result.end(), indices.begin() + clusterStarts[c] * 3,
+                  indices.begin() + end * 3);
+  }
+  return result;
+}
+
+// Renumbers vertices in the order the index buffer first references them, so
+// vertex fetches walk the vertex buffer mostly sequentially. Unreferenced
+// vertices move to the end.
+template <typename V>
+void optimizeVertexFetch(std::vector<uint32_t> &indices,
+                         std::vector<V> &vertices) {
+  constexpr uint32_t UNASSIGNED = ~0u;
+  std::vector<uint32_t> remap(vertices.size(), UNASSIGNED);
+  std::vector<V> reordered;
+  reordered.reserve(vertices.size());
+  for (uint32_t &index : indices) {
+    if (remap[index] == UNASSIGNED) {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  for (size_t v = 0; v < vertices.size(); v++) {
+    if (remap[v] == UNASSIGNED) {
+      reordered.push_back(vertices[v]);
+    }
+  }
+  vertices = std::move(reordered);
+}
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <unordered_set>
+#include <vector>
+
+// Levels of detail a mesh has at most, the full mesh included
+constexpr uint32_t MAX_MESH_LODS = 8;
+
+// One level of detail: a range of the index buffer all levels share, and the
+// farthest, in model units, a vertex of the full mesh lies from its surface.
+// Stored in the mesh cache; the layout matches the uniform buffer of
+// shader.slang and cull.slang.
+struct MeshLod {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float error;
+  uint32_t padding;
+};
+static_assert(sizeof(MeshLod) == 16);
+
+namespace simplify_detail {
+
+using Vec3 = std::array<double, 3>;
+
+inline Vec3 toVec3(const MeshPosition &p) { return {p[0], p[1], p[2]}; }
+inline Vec3 sub(const Vec3 &a, const Vec3 &b) {
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+inline double dot(const Vec3 &a, const Vec3 &b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+inline Vec3 cross(const Vec3 &a, const Vec3 &b) {
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+          a[0] * b[1] - a[1] * b[0]};
+}
+inline Vec3 mad(const Vec3 &a, const Vec3 &b, double s) {
+  return {a[0] + b[0] * s, a[1] + b[1] * s, a[2] + b[2] * s};
+}
+
+// Distance from p to the triangle abc, by the closest point as in Ericson's
+// "Real-Time Collision Detection", 5.1.5
+inline double triangleDistance(const Vec3 &p, const Vec3 &a, const Vec3 &b,
+                               const Vec3 &c) {
+  Vec3 ab = sub(b, a), ac = sub(c, a), ap = sub(p, a);
+  auto distance = [&](const Vec3 &q) {
+    Vec3 d = sub(p, q);
+    return std::sqrt(dot(d, d));
+  };
+  double d1 = dot(ab, ap), d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0) {
+    return distance(a);
+  }
+  Vec3 bp = sub(p, b);
+  double d3 = dot(ab, bp), d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3) {
+    return distance(b);
+  }
+  double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return distance(mad(a, ab, d1 / (d1 - d3)));
+  }
+  Vec3 cp = sub(p, c);
+  double d5 = dot(ab, cp), d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6) {
+    return distance(c);
+  }
+  double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return distance(mad(a, ac, d2 / (d2 - d6)));
+  }
+  double va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+    return distance(mad(b, sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+  }
+  double denominator = va + vb + vc;
+  if (denominator <= 0) {
+    // Degenerate: the nearest corner will do
+    return std::min({distance(a), distance(b), distance(c)});
+  }
+  return distance(mad(mad(a, ab, vb / denominator), ac, vc / denominator));
+}
+
+// Sum of squared distances to planes, weighted by the areas of the
+// triangles they came from, as the symmetric 4x4 matrix of Garland and
+// Heckbert's "Surface Simplification Using Quadric Error Metrics".
+struct Quadric {
+  double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+  double ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+  double weight = 0;
+
+  void addPlane(const Vec3 &n, double d, double w) {
+    a2 += w * n[0] * n[0];
+    b2 += w * n[1] * n[1];
+    c2 += w * n[2] * n[2];
+    d2 += w * d * d;
+    ab += w * n[0] * n[1];
+    ac += w * n[0] * n[2];
+    ad += w * n[0] * d;
+    bc += w * n[1] * n[2];
+    bd += w * n[1] * d;
+    cd += w * n[2] * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a2 += q.a2, b2 += q.b2, c2 += q.c2, d2 += q.d2;
+    ab += q.ab, ac += q.ac, ad += q.ad;
+    bc += q.bc, bd += q.bd, cd += q.cd;
+    weight += q.weight;
+  }
+
+  // Mean squared distance of p to the planes, weighted by area
+  double error(const Vec3 &p) const {
+    double x = p[0], y = p[1], z = p[2];
+    double e = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+               2 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y +
+                    cd * z);
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double error;
+};
+
+// Whether moving vertex from onto to turns any triangle around from that
+// survives the collapse over
+inline bool collapseFlips(uint32_t from, uint32_t to,
+                          const std::vector<uint32_t> &indices,
+                          const std::vector<uint32_t> &offsets,
+                          const std::vector<uint32_t> &adjacency,
+                          const std::vector<MeshPosition> &positions) {
+  Vec3 target = toVec3(positions[to]);
+  for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++) {
+    const uint32_t *t = &indices[size_t(adjacency[a]) * 3];
+    if (t[0] == to || t[1] == to || t[2] == to) {
+      continue;
+    }
+    Vec3 p[3];
+    Vec3 moved[3];
+    for (int c = 0; c < 3; c++) {
+      p[c] = toVec3(positions[t[c]]);
+      moved[c] = t[c] == from ? target : p[c];
+    }
+    Vec3 before = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+    Vec3 after = cross(sub(moved[1], moved[0]), sub(moved[2], moved[0]));
+    if (dot(before, after) <= 0.0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace simplify_detail
+
+// Collapses edges until at most targetIndexCount indices remain, no collapse
+// is left within maxError, or none can be made without flipping a triangle.
+// Each collapse moves one vertex onto a neighbour, so the result indexes the
+// same vertex buffer. Costs follow the quadric error metric: the error of a
+// collapse is the quadric of the vertex removed, which carries those of the
+// vertices it absorbed, measured at the vertex kept. That is a root mean
+// square distance, which maxError bounds.
+//
+// Vertices on an open edge never move, which keeps borders and texture
+// seams, where neighbouring triangles index different vertices at the same
+// position, from opening. Returns through error the farthest any vertex
+// removed lies from the triangles around the vertex it ended up on: the mean
+// hides a vertex far off a large flat area, which is what shows on screen.
+inline std::vector<uint32_t>
+simplifyMesh(const std::vector<uint32_t> &indices,
+             const std::vector<MeshPosition> &positions,
+             size_t targetIndexCount, float maxError, float &error) {
+  using namespace simplify_detail;
+  size_t vertexCount = positions.size();
+  std::vector<uint32_t> result(indices.begin(),
+                               indices.begin() + indices.size() / 3 * 3);
+  error = 0.0f;
+
+  // A directed edge without its reverse is open
+  std::unordered_set<uint64_t> edges;
+  edges.reserve(result.size());
+  auto edgeKey = [](uint32_t a, uint32_t b) {
+    return (uint64_t(a) << 32) | b;
+  };
+  for (size_t i = 0; i < result.size(); i += 3) {
+    for (size_t c = 0; c < 3; c++) {
+      edges.insert(edgeKey(result[i + c], result[i + (c + 1) % 3]));
+    }
+  }
+  std::vector<bool> locked(vertexCount, false);
+  std::vector<Quadric> quadrics(vertexCount);
+  for (size_t i = 0; i < result.size(); i += 3) {
+    for (size_t c = 0; c < 3; c++) {
+      uint32_t a = result[i + c];
+      uint32_t b = result[i + (c + 1) % 3];
+      if (!edges.contains(edgeKey(b, a))) {
+        locked[a] = true;
+        locked[b] = true;
+      }
+    }
+    Vec3 p0 = toVec3(positions[result[i]]);
+    Vec3 normal = cross(sub(toVec3(positions[result[i + 1]]), p0),
+                        sub(toVec3(positions[result[i + 2]]), p0));
+    double length = std::sqrt(dot(normal, normal));
+    if (length == 0.0) {
+      continue;
+    }
+    for (double &n : normal) {
+      n /= length;
+    }
+    for (size_t c = 0; c < 3; c++) {
+      quadrics[result[i + c]].addPlane(normal, -dot(normal, p0),
+                                       0.5 * length);
+    }
+  }
+
+  double maxErrorSquared = double(maxError) * double(maxError);
+  std::vector<uint32_t> offsets(vertexCount + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<uint32_t> collapseTo(vertexCount);
+  std::vector<bool> touched(vertexCount);
+  // The vertex each one has ended up on through the collapses so far
+  std::vector<uint32_t> survivor(vertexCount);
+  std::iota(survivor.begin(), survivor.end(), 0u);
+  // Triangles around each vertex, as offsets into adjacency
+  auto buildAdjacency = [&] {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint32_t index : result) {
+      offsets[index + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+      offsets[v + 1] += offsets[v];
+    }
+    adjacency.resize(result.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < result.size() / 3; t++) {
+      for (size_t c = 0; c < 3; c++) {
+        adjacency[fill[result[t * 3 + c]]++] = static_cast<uint32_t>(t);
+      }
+    }
+  };
+  while (result.size() > targetIndexCount) {
+    buildAdjacency();
+
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (size_t c = 0; c < 3; c++) {
+        uint32_t a = result[i + c];
+        uint32_t b = result[i + (c + 1) % 3];
+        if (!locked[a]) {
+          collapses.push_back({a, b, quadrics[a].error(toVec3(positions[b]))});
+        }
+        if (!locked[b]) {
+          collapses.push_back({b, a, quadrics[b].error(toVec3(positions[a]))});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &x, const Collapse &y) {
+                return x.error < y.error;
+              });
+
+    // A collapse removes about two triangles. The vertices of each collapse
+    // sit out the rest of the pass, so the costs and flip tests of later ones
+    // still hold.
+    size_t goal = std::max<size_t>((result.size() - targetIndexCount) / 6, 1);
+    size_t applied = 0;
+    std::iota(collapseTo.begin(), collapseTo.end(), 0u);
+    std::fill(touched.begin(), touched.end(), false);
+    for (const Collapse &collapse : collapses) {
+      if (applied == goal || collapse.error > maxErrorSquared) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to] ||
+          collapseFlips(collapse.from, collapse.to, result, offsets,
+                        adjacency, positions)) {
+        continue;
+      }
+      collapseTo[collapse.from] = collapse.to;
+      quadrics[collapse.to].add(quadrics[collapse.from]);
+      touched[collapse.from] = true;
+      touched[collapse.to] = true;
+      applied++;
+    }
+    if (applied == 0) {
+      break;
+    }
+    // No collapse in a pass lands on a vertex that moved in it
+    for (uint32_t &v : survivor) {
+      v = collapseTo[v];
+    }
+
+    // Triangles that lost a corner to the collapse are dropped
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = collapseTo[result[i]];
+      uint32_t b = collapseTo[result[i + 1]];
+      uint32_t c = collapseTo[result[i + 2]];
+      if (a != b && b != c && a != c) {
+        result[write++] = a;
+        result[write++] = b;
+        result[write++] = c;
+      }
+    }
+    result.resize(write);
+  }
+
+  // Vertices whose triangles all collapsed away have nothing around them and
+  // are not measured
+  buildAdjacency();
+  double largestError = 0.0;
+  for (size_t v = 0; v < vertexCount; v++) {
+    uint32_t kept = survivor[v];
+    if (kept == v || offsets[kept] == offsets[kept + 1]) {
+      continue;
+    }
+    Vec3 p = toVec3(positions[v]);
+    double nearest = std::numeric_limits<double>::max();
+    for (uint32_t a = offsets[kept]; a < offsets[kept + 1]; a++) {
+      const uint32_t *t = &result[size_t(adjacency[a]) * 3];
+      nearest = std::min(nearest, triangleDistance(p, toVec3(positions[t[0]]),
+                                                   toVec3(positions[t[1]]),
+                                                   toVec3(positions[t[2]])));
+    }
+    largestError = std::max(largestError, nearest);
+  }
+  error = static_cast<float>(largestError);
+  return result;
+}
+
+// Appends coarser levels of the triangles in indices to indices, each
+// simplified from the full mesh to half the triangles of the level before and
+// reordered for the vertex cache. Stops at MAX_MESH_LODS levels, or once a
+// level would keep more than 85% of the one before. Returns every level, the
+// full mesh first.
+inline std::vector<MeshLod>
+buildLodChain(std::vector<uint32_t> &indices,
+              const std::vector<MeshPosition> &positions) {
+  std::vector<uint32_t> base = indices;
+  std::vector<MeshLod> lods{
+    {0, static_cast<uint32_t>(base.size()), 0.0f, 0}};
+  size_t target = base.size();
+  while (lods.size() < MAX_MESH_LODS) {
+    target = target / 6 * 3;
+    if (target == 0) {
+      break;
+    }
+    float error = 0.0f;
+    std::vector<uint32_t> level =
+      simplifyMesh(base, positions, target,
+                   std::numeric_limits<float>::max(), error);
+    if (level.empty() || level.size() * 100 > lods.back().indexCount * 85ull) {
+      break;
+    }
+    std::vector<uint32_t> clusterStarts;
+    level = optimizeVertexCache(level, positions.size(), clusterStarts);
+    lods.push_back({static_cast<uint32_t>(indices.size()),
+                    static_cast<uint32_t>(level.size()), error, 0});
+    indices.insert(indices.end(), level.begin(), level.end());
+  }
+  return lods;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Limits of one meshlet, the sizes commonly recommended for mesh shaders so
+// the same split would serve them too
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A run of triangles of the index buffer and the bounds the cull pass tests
+// it by. Stored in the mesh cache, in model space; the layout matches
+// shaders/cull.slang.
+struct Meshlet {
+  MeshPosition center;
+  float radius;
+  // Normal cone: the meshlet faces away from every viewpoint from which
+  // the direction to coneApex is within coneCutoff of coneAxis, i.e.
+  // dot(normalize(coneApex - eye), coneAxis) >= coneCutoff. A cutoff above 1
+  // means the normals spread too far for the test to ever pass.
+  MeshPosition coneAxis;
+  float coneCutoff;
+  MeshPosition coneApex;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  uint32_t padding[3];
+};
+static_assert(sizeof(Meshlet) == 64);
+
+namespace meshlet_detail {
+
+using Vec3 = std::array<double, 3>;
+
+inline Vec3 toVec3(const MeshPosition &p) { return {p[0], p[1], p[2]}; }
+inline Vec3 sub(const Vec3 &a, const Vec3 &b) {
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+inline double dot(const Vec3 &a, const Vec3 &b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+inline Vec3 cross(const Vec3 &a, const Vec3 &b) {
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+          a[0] * b[1] - a[1] * b[0]};
+}
+inline MeshPosition toPosition(const Vec3 &v) {
+  return {static_cast<float>(v[0]), static_cast<float>(v[1]),
+          static_cast<float>(v[2])};
+}
+
+// Bounding sphere and normal cone of the meshlet's triangles, after
+// meshoptimizer's meshopt_computeClusterBounds()
+inline void computeBounds(Meshlet &meshlet, const std::vector<uint32_t> &indices,
+                          const std::vector<MeshPosition> &positions) {
+  size_t first = meshlet.firstIndex;
+  size_t end = first + meshlet.indexCount;
+
+  // Centered on the bounds, reaching the farthest vertex
+  Vec3 boundsMin{HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  Vec3 boundsMax{-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (size_t i = first; i < end; i++) {
+    Vec3 p = toVec3(positions[indices[i]]);
+    for (int axis = 0; axis < 3; axis++) {
+      boundsMin[axis] = std::min(boundsMin[axis], p[axis]);
+      boundsMax[axis] = std::max(boundsMax[axis], p[axis]);
+    }
+  }
+  Vec3 center{0.5 * (boundsMin[0] + boundsMax[0]),
+              0.5 * (boundsMin[1] + boundsMax[1]),
+              0.5 * (boundsMin[2] + boundsMax[2])};
+  double radiusSquared = 0.0;
+  for (size_t i = first; i < end; i++) {
+    Vec3 offset = sub(toVec3(positions[indices[i]]), center);
+    radiusSquared = std::max(radiusSquared, dot(offset, offset));
+  }
+  meshlet.center = toPosition(center);
+  meshlet.radius = static_cast<float>(std::sqrt(radiusSquared));
+
+  // The cone axis is the average of the unit triangle normals; degenerate
+  // triangles face nowhere and are left out
+  std::vector<Vec3> normals;
+  std::vector<Vec3> corners;
+  Vec3 axis{};
+  for (size_t i = first; i + 2 < end; i += 3) {
+    Vec3 a = toVec3(positions[indices[i]]);
+    Vec3 normal = cross(sub(toVec3(positions[indices[i + 1]]), a),
+                        sub(toVec3(positions[indices[i + 2]]), a));
+    double length = std::sqrt(dot(normal, normal));
+    if (length == 0.0) {
+      continue;
+    }
+    for (int c = 0; c < 3; c++) {
+      normal[c] /= length;
+      axis[c] += normal[c];
+    }
+    normals.push_back(normal);
+    corners.push_back(a);
+  }
+  meshlet.coneAxis = {0.0f, 0.0f, 0.0f};
+  meshlet.coneApex = meshlet.center;
+  meshlet.coneCutoff = 2.0f;
+  double axisLength = std::sqrt(dot(axis, axis));
+  if (axisLength == 0.0) {
+    return;
+  }
+  for (double &c : axis) {
+    c /= axisLength;
+  }
+  double minDot = 1.0;
+  for (const Vec3 &normal : normals) {
+    minDot = std::min(minDot, dot(normal, axis));
+  }
+  // Cones close to a hemisphere or wider are never culled, and make the apex
+  // below unstable
+  if (minDot <= 0.1) {
+    return;
+  }
+
+  // The apex lies on the axis behind the center, far enough to be behind
+  // every triangle's plane
+  double apexDistance = 0.0;
+  for (size_t t = 0; t < normals.size(); t++) {
+    double distance =
+      dot(sub(center, corners[t]), normals[t]) / dot(axis, normals[t]);
+    apexDistance = std::max(apexDistance, distance);
+  }
+  meshlet.coneAxis = toPosition(axis);
+  meshlet.coneApex = toPosition({center[0] - axis[0] * apexDistance,
+                                 center[1] - axis[1] * apexDistance,
+                                 center[2] - axis[2] * apexDistance});
+  // Viewing directions within 90 degrees minus the cone's half angle of
+  // the axis see only back faces: cos(90 - a) = sin(a)
+  meshlet.coneCutoff = static_cast<float>(std::sqrt(1.0 - minDot * minDot));
+}
+
+} // namespace meshlet_detail
+
+// Splits indices into meshlets of consecutive triangles, each with at most
+// MESHLET_MAX_VERTICES distinct vertices and MESHLET_MAX_TRIANGLES
+// triangles. The triangle order is kept, so every meshlet is a range of the
+// index buffer as it is; after optimizeVertexCache() neighbouring triangles
+// share most of their vertices and the meshlets come out nearly full.
+inline std::vector<Meshlet>
+buildMeshlets(const std::vector<uint32_t> &indices,
+              const std::vector<MeshPosition> &positions) {
+  constexpr uint32_t UNUSED = ~0u;
+  // Meshlet that last referenced each vertex
+  std::vector<uint32_t> owner(positions.size(), UNUSED);
+  std::vector<Meshlet> meshlets;
+  uint32_t vertexCount = 0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    auto current = static_cast<uint32_t>(meshlets.size()) - 1;
+    uint32_t newVertices = 0;
+    for (size_t c = 0; c < 3 && !meshlets.empty(); c++) {
+      newVertices += owner[indices[i + c]] != current;
+    }
+    if (meshlets.empty() ||
+        meshlets.back().indexCount == MESHLET_MAX_TRIANGLES * 3 ||
+        vertexCount + newVertices > MESHLET_MAX_VERTICES) {
+      meshlets.push_back(Meshlet{});
+      meshlets.back().firstIndex = static_cast<uint32_t>(i);
+      current = static_cast<uint32_t>(meshlets.size()) - 1;
+      vertexCount = 0;
+    }
+    for (size_t c = 0; c < 3; c++) {
+      if (owner[indices[i + c]] != current) {
+        owner[indices[i + c]] = current;
+        vertexCount++;
+      }
+    }
+    meshlets.back().indexCount += 3;
+  }
+  for (Meshlet &meshlet : meshlets) {
+    meshlet_detail::computeBounds(meshlet, indices, positions);
+  }
+  return meshlets;
+}
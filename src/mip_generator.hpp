@@ -0,0 +1,355 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+  defined(_M_IX86)
+#define MIP_GENERATOR_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MIP_TARGET_AVX2
+#else
+#define MIP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Where each level of a mip chain goes in one buffer, largest level first.
+// Rows are tightly packed RGBA8.
+struct MipLevelLayout {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+struct MipChainLayout {
+  std::vector<MipLevelLayout> levels;
+  size_t totalSize = 0;
+};
+
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+  return static_cast<uint32_t>(
+           std::floor(std::log2(std::max(width, height)))) +
+         1;
+}
+
+// The full chain down to 1x1, each level starting at a multiple of alignment.
+inline MipChainLayout mipChainLayout(uint32_t width, uint32_t height,
+                                     size_t alignment = 16) {
+  MipChainLayout layout;
+  for (uint32_t level = 0; level < mipLevelCount(width, height); level++) {
+    MipLevelLayout entry;
+    entry.width = std::max(width >> level, 1u);
+    entry.height = std::max(height >> level, 1u);
+    entry.offset = layout.totalSize;
+    entry.size = static_cast<size_t>(entry.width) * entry.height * 4;
+    layout.totalSize =
+      (entry.offset + entry.size + alignment - 1) / alignment * alignment;
+    layout.levels.push_back(entry);
+  }
+  return layout;
+}
+
+// Implementations of the 2x2 downsample. All produce identical output; they
+// differ in speed only.
+enum class MipKernel { Scalar, Sse2, Avx2 };
+
+inline const char *mipKernelName(MipKernel kernel) {
+  switch (kernel) {
+  case MipKernel::Sse2:
+    return "sse2";
+  case MipKernel::Avx2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+inline bool mipKernelSupported(MipKernel kernel) {
+#ifdef MIP_GENERATOR_X86
+  switch (kernel) {
+  case MipKernel::Sse2:
+    return true;
+  case MipKernel::Avx2: {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+    __cpuid(info, 1);
+    // AVX and OSXSAVE, then the OS saving YMM state, then AVX2
+    if ((info[2] & (1 << 28 | 1 << 27)) != (1 << 28 | 1 << 27) ||
+        (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+  default:
+    return true;
+  }
+#else
+  return kernel == MipKernel::Scalar;
+#endif
+}
+
+inline MipKernel bestMipKernel() {
+  for (MipKernel kernel : {MipKernel::Avx2, MipKernel::Sse2}) {
+    if (mipKernelSupported(kernel)) {
+      return kernel;
+    }
+  }
+  return MipKernel::Scalar;
+}
+
+namespace mip_detail {
+
+// Linear values are looked up back to 8 bits in this many steps; enough that
+// the steepest part of the sRGB curve moves less than half a code per step.
+constexpr int32_t LINEAR_STEPS = 16384;
+constexpr float OUTPUT_SCALE = 0.25f * (LINEAR_STEPS - 1);
+
+// Color channels go through the sRGB curve, alpha only through 1/255. Both
+// tables hold the color half first and the alpha half second.
+struct Tables {
+  alignas(32) std::array<float, 512> toLinear;
+  alignas(32) std::array<int32_t, 2 * LINEAR_STEPS> fromLinear;
+};
+
+inline const Tables &tables() {
+  static const Tables result = [] {
+    Tables t{};
+    for (int i = 0; i < 256; i++) {
+      float c = static_cast<float>(i) / 255.0f;
+      t.toLinear[i] = c <= 0.04045f ? c / 12.92f
+                                    : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      t.toLinear[256 + i] = c;
+    }
+    for (int32_t i = 0; i < LINEAR_STEPS; i++) {
+      float v = static_cast<float>(i) / (LINEAR_STEPS - 1);
+      float c = v <= 0.0031308f ? v * 12.92f
+                                : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+      t.fromLinear[i] = static_cast<int32_t>(std::lround(c * 255.0f));
+      t.fromLinear[LINEAR_STEPS + i] =
+        static_cast<int32_t>(std::lround(v * 255.0f));
+    }
+    return t;
+  }();
+  return result;
+}
+
+// Two rows of the source level feeding one row of the destination. A
+// dimension of 1 repeats its only row or column.
+struct RowPair {
+  const uint8_t *row0;
+  const uint8_t *row1;
+};
+
+inline RowPair sourceRows(const uint8_t *src, const MipLevelLayout &srcLevel,
+                          uint32_t y) {
+  size_t pitch = static_cast<size_t>(srcLevel.width) * 4;
+  uint32_t y0 = std::min(2 * y, srcLevel.height - 1);
+  uint32_t y1 = std::min(2 * y + 1, srcLevel.height - 1);
+  return {src + y0 * pitch, src + y1 * pitch};
+}
+
+// Output texels [x0, width) of one row. Levels halve with rounding down, so
+// the right neighbour only needs clamping when the source is 1 wide.
+inline void downsampleRowScalar(RowPair rows, uint32_t srcWidth, uint8_t *out,
+                                uint32_t x0, uint32_t width) {
+  const Tables &t = tables();
+  for (uint32_t x = x0; x < width; x++) {
+    uint32_t left = std::min(2 * x, srcWidth - 1) * 4;
+    uint32_t right = std::min(2 * x + 1, srcWidth - 1) * 4;
+    for (uint32_t c = 0; c < 4; c++) {
+      uint32_t in = c == 3 ? 256 : 0;
+      float sum = (t.toLinear[in + rows.row0[left + c]] +
+                   t.toLinear[in + rows.row1[left + c]]) +
+                  (t.toLinear[in + rows.row0[right + c]] +
+                   t.toLinear[in + rows.row1[right + c]]);
+      auto index = static_cast<int32_t>(sum * OUTPUT_SCALE + 0.5f);
+      out[x * 4 + c] = static_cast<uint8_t>(
+        t.fromLinear[(c == 3 ? LINEAR_STEPS : 0) + index]);
+    }
+  }
+}
+
+#ifdef MIP_GENERATOR_X86
+// One output texel per step: table lookups stay scalar, as SSE2 has no
+// gather, but the sums and the conversion back run four channels at a time.
+inline void downsampleRowSse2(RowPair rows, uint32_t srcWidth, uint8_t *out,
+                              uint32_t width) {
+  if (srcWidth < 2) {
+    downsampleRowScalar(rows, srcWidth, out, 0, width);
+    return;
+  }
+  const Tables &t = tables();
+  const float *linear = t.toLinear.data();
+  auto load = [linear](const uint8_t *texel) {
+    return _mm_setr_ps(linear[texel[0]], linear[texel[1]], linear[texel[2]],
+                       linear[256 + texel[3]]);
+  };
+  const __m128 scale = _mm_set1_ps(OUTPUT_SCALE);
+  const __m128 half = _mm_set1_ps(0.5f);
+  alignas(16) int32_t index[4];
+  for (uint32_t x = 0; x < width; x++) {
+    const uint8_t *a = rows.row0 + x * 8;
+    const uint8_t *b = rows.row1 + x * 8;
+    __m128 sum = _mm_add_ps(_mm_add_ps(load(a), load(b)),
+                            _mm_add_ps(load(a + 4), load(b + 4)));
+    _mm_store_si128(reinterpret_cast<__m128i *>(index),
+                    _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), half)));
+    out[x * 4 + 0] = static_cast<uint8_t>(t.fromLinear[index[0]]);
+    out[x * 4 + 1] = static_cast<uint8_t>(t.fromLinear[index[1]]);
+    out[x * 4 + 2] = static_cast<uint8_t>(t.fromLinear[index[2]]);
+    out[x * 4 + 3] =
+      static_cast<uint8_t>(t.fromLinear[LINEAR_STEPS + index[3]]);
+  }
+}
+
+// Linear values of the two texels in the low half of texels
+MIP_TARGET_AVX2 inline __m256 linearAvx2(__m128i texels) {
+  const __m256i offset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+  __m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(texels), offset);
+  return _mm256_i32gather_ps(tables().toLinear.data(), index, 4);
+}
+
+// Sums columns 2x and 2x + 1 of both rows for two neighbouring outputs, in the
+// same order as the scalar kernel.
+MIP_TARGET_AVX2 inline __m256 sumPairAvx2(__m128i top, __m128i bottom) {
+  __m256 first = _mm256_add_ps(linearAvx2(top), linearAvx2(bottom));
+  __m256 second = _mm256_add_ps(linearAvx2(_mm_srli_si128(top, 8)),
+                                linearAvx2(_mm_srli_si128(bottom, 8)));
+  return _mm256_add_ps(_mm256_permute2f128_ps(first, second, 0x20),
+                       _mm256_permute2f128_ps(first, second, 0x31));
+}
+
+MIP_TARGET_AVX2 inline __m256i encodeAvx2(__m256 sum) {
+  const __m256i offset =
+    _mm256_setr_epi32(0, 0, 0, LINEAR_STEPS, 0, 0, 0, LINEAR_STEPS);
+  __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(
+    _mm256_mul_ps(sum, _mm256_set1_ps(OUTPUT_SCALE)), _mm256_set1_ps(0.5f)));
+  return _mm256_i32gather_epi32(tables().fromLinear.data(),
+                                _mm256_add_epi32(index, offset), 4);
+}
+
+// Four output texels per step, with the table lookups done by gathers.
+MIP_TARGET_AVX2 inline void downsampleRowAvx2(RowPair rows, uint32_t srcWidth,
+                                              uint8_t *out, uint32_t width) {
+  if (srcWidth < 2) {
+    downsampleRowScalar(rows, srcWidth, out, 0, width);
+    return;
+  }
+  uint32_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const auto *top = reinterpret_cast<const __m128i *>(rows.row0 + x * 8);
+    const auto *bottom = reinterpret_cast<const __m128i *>(rows.row1 + x * 8);
+    __m256i texels01 =
+      encodeAvx2(sumPairAvx2(_mm_loadu_si128(top), _mm_loadu_si128(bottom)));
+    __m256i texels23 = encodeAvx2(
+      sumPairAvx2(_mm_loadu_si128(top + 1), _mm_loadu_si128(bottom + 1)));
+    // Packing works per 128-bit lane and leaves the texels in order 0, 2, 1, 3
+    __m256i words = _mm256_packus_epi32(texels01, texels23);
+    __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                     _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x * 4),
+                     _mm_shuffle_epi32(bytes, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  downsampleRowScalar(rows, srcWidth, out, x, width);
+}
+#endif
+
+inline void downsampleRow(MipKernel kernel, RowPair rows, uint32_t srcWidth,
+                          uint8_t *out, uint32_t width) {
+#ifdef MIP_GENERATOR_X86
+  if (kernel == MipKernel::Avx2) {
+    downsampleRowAvx2(rows, srcWidth, out, width);
+    return;
+  }
+  if (kernel == MipKernel::Sse2) {
+    downsampleRowSse2(rows, srcWidth, out, width);
+    return;
+  }
+#endif
+  (void)kernel;
+  downsampleRowScalar(rows, srcWidth, out, 0, width);
+}
+
+// Output rows handed to one task at a time
+constexpr uint32_t BAND_ROWS = 16;
+
+} // namespace mip_detail
+
+// Writes the mip chain of an sRGB RGBA8 image into dst, laid out as layout,
+// level 0 being a copy of source. Each level is a 2x2 box filter of the one
+// above it, averaging color in linear space and alpha as stored. Odd sizes
+// round down, dropping the last row or column, like vkCmdBlitImage does.
+//
+// Levels are computed into scratch memory, which the next level reads, and
+// copied out band by band, so dst may be write-combined staging memory that is
+// slow to read. Bands of rows are spread over pool when one is given.
+inline void generateMipChain(const uint8_t *source,
+                             const MipChainLayout &layout, uint8_t *dst,
+                             ThreadPool *pool,
+                             MipKernel kernel = bestMipKernel()) {
+  using namespace mip_detail;
+  if (!mipKernelSupported(kernel)) {
+    kernel = MipKernel::Scalar;
+  }
+  tables();
+
+  auto forEachBand = [pool](uint32_t rows, auto &&body) {
+    size_t bands = (rows + BAND_ROWS - 1) / BAND_ROWS;
+    auto run = [&](size_t band) {
+      uint32_t first = static_cast<uint32_t>(band) * BAND_ROWS;
+      body(first, std::min(first + BAND_ROWS, rows));
+    };
+    if (pool && bands > 1) {
+      pool->parallelFor(bands, run);
+    } else {
+      for (size_t band = 0; band < bands; band++) {
+        run(band);
+      }
+    }
+  };
+
+  const MipLevelLayout &base = layout.levels[0];
+  forEachBand(base.height, [&](uint32_t first, uint32_t last) {
+    size_t pitch = static_cast<size_t>(base.width) * 4;
+    std::memcpy(dst + base.offset + first * pitch, source + first * pitch,
+                (last - first) * pitch);
+  });
+
+  std::array<std::vector<uint8_t>, 2> scratch;
+  const uint8_t *previous = source;
+  for (size_t level = 1; level < layout.levels.size(); level++) {
+    const MipLevelLayout &srcLevel = layout.levels[level - 1];
+    const MipLevelLayout &dstLevel = layout.levels[level];
+    std::vector<uint8_t> &current = scratch[level % 2];
+    current.resize(dstLevel.size);
+    size_t pitch = static_cast<size_t>(dstLevel.width) * 4;
+    forEachBand(dstLevel.height, [&](uint32_t first, uint32_t last) {
+      for (uint32_t y = first; y < last; y++) {
+        downsampleRow(kernel, sourceRows(previous, srcLevel, y),
+                      srcLevel.width, current.data() + y * pitch,
+                      dstLevel.width);
+      }
+      std::memcpy(dst + dstLevel.offset + first * pitch,
+                  current.data() + first * pitch, (last - first) * pitch);
+    });
+    previous = current.data();
+  }
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// texcoord of an ObjCorner whose face has none. No reference resolves to it:
+// relative ones that would are rejected.
+constexpr int32_t OBJ_NO_TEXCOORD = -1;
+
+// Face corner of a triangulated OBJ, as 0-based indices into ObjData's
+// positions and texcoords.
+struct ObjCorner {
+  int32_t position;
+  int32_t texcoord;
+};
+
+// The geometry of an OBJ file: v and vt records, plus the corners of every
+// face triangulated as a fan, three per triangle, in file order. Normals,
+// groups and materials are ignored.
+struct ObjData {
+  std::vector<float> positions; // x, y, z per v record
+  std::vector<float> texcoords; // u, v per vt record
+  std::vector<ObjCorner> corners;
+};
+
+namespace obj_detail {
+// Smallest piece of the file worth handing to a thread
+constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+struct ChunkResult {
+  ObjData data;
+  // Corners holding negative (relative) references. These were resolved
+  // against the chunk's own record counts and still need the number of
+  // records in earlier chunks added.
+  std::vector<uint32_t> relativePositions;
+  std::vector<uint32_t> relativeTexcoords;
+};
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+inline const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && isSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+inline const char *parseFloat(const char *p, const char *end, float &value) {
+  p = skipSpaces(p, end);
+  // from_chars rejects the leading '+' some exporters write
+  if (p < end && *p == '+') {
+    p++;
+  }
+  auto [next, error] = std::from_chars(p, end, value);
+  if (error != std::errc()) {
+    throw std::runtime_error("malformed number in OBJ file");
+  }
+  return next;
+}
+
+// Turns a 1-based or negative OBJ reference into a 0-based index against
+// count records seen so far in this chunk. Returns false for relative
+// references, whose result may still be negative.
+inline bool resolveReference(int32_t reference, size_t count, int32_t &index) {
+  if (reference > 0) {
+    index = reference - 1;
+    return true;
+  }
+  if (reference == 0) {
+    throw std::runtime_error("invalid index 0 in OBJ face");
+  }
+  index = static_cast<int32_t>(count) + reference;
+  return false;
+}
+
+inline void parseFace(const char *p, const char *end, ChunkResult &chunk) {
+  ObjData &data = chunk.data;
+  size_t positionCount = data.positions.size() / 3;
+  size_t texcoordCount = data.texcoords.size() / 2;
+
+  ObjCorner first{}, previous{};
+  uint32_t cornerCount = 0;
+  bool firstRelative[2] = {false, false};
+  bool previousRelative[2] = {false, false};
+  while (true) {
+    p = skipSpaces(p, end);
+    if (p == end) {
+      break;
+    }
+    ObjCorner corner{-1, OBJ_NO_TEXCOORD};
+    bool relative[2] = {false, false};
+
+    int32_t reference = 0;
+    auto [next, error] = std::from_chars(p, end, reference);
+    if (error != std::errc()) {
+      throw std::runtime_error("malformed face in OBJ file");
+    }
+    relative[0] = !resolveReference(reference, positionCount, corner.position);
+    p = next;
+    if (p < end && *p == '/') {
+      p++;
+      if (p < end && *p != '/') {
+        auto [texNext, texError] = std::from_chars(p, end, reference);
+        if (texError != std::errc()) {
+          throw std::runtime_error("malformed face in OBJ file");
+        }
+        relative[1] =
+          !resolveReference(reference, texcoordCount, corner.texcoord);
+        p = texNext;
+      }
+      // Normal references are not used
+      while (p < end && !isSpace(*p)) {
+        p++;
+      }
+    }
+
+    if (cornerCount == 0) {
+      first = corner;
+      firstRelative[0] = relative[0];
+      firstRelative[1] = relative[1];
+    } else if (cornerCount >= 2) {
+      // Fan triangulation: (0, i - 1, i)
+      const ObjCorner triangle[3] = {first, previous, corner};
+      const bool *triangleRelative[3] = {firstRelative, previousRelative,
+                                         relative};
+      for (int i = 0; i < 3; i++) {
+        auto cornerIndex = static_cast<uint32_t>(data.corners.size());
+        if (triangleRelative[i][0]) {
+          chunk.relativePositions.push_back(cornerIndex);
+        }
+        if (triangleRelative[i][1]) {
+          chunk.relativeTexcoords.push_back(cornerIndex);
+        }
+        data.corners.push_back(triangle[i]);
+      }
+    }
+    previous = corner;
+    previousRelative[0] = relative[0];
+    previousRelative[1] = relative[1];
+    cornerCount++;
+  }
+}
+
+inline void parseChunk(const char *begin, const char *end,
+                       ChunkResult &chunk) {
+  ObjData &data = chunk.data;
+  const char *line = begin;
+  while (line < end) {
+    const char *lineEnd =
+      static_cast<const char *>(std::memchr(line, '\n', end - line));
+    if (lineEnd == nullptr) {
+      lineEnd = end;
+    }
+    const char *contentEnd = lineEnd;
+    if (contentEnd > line && contentEnd[-1] == '\r') {
+      contentEnd--;
+    }
+
+    const char *p = skipSpaces(line, contentEnd);
+    if (contentEnd - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+      float x, y, z;
+      p = parseFloat(p + 1, contentEnd, x);
+      p = parseFloat(p, contentEnd, y);
+      parseFloat(p, contentEnd, z);
+      data.positions.insert(data.positions.end(), {x, y, z});
+    } else if (contentEnd - p >= 3 && p[0] == 'v' && p[1] == 't' &&
+               isSpace(p[2])) {
+      float u, v = 0.0f;
+      p = parseFloat(p + 2, contentEnd, u);
+      if (skipSpaces(p, contentEnd) != contentEnd) {
+        parseFloat(p, contentEnd, v);
+      }
+      data.texcoords.insert(data.texcoords.end(), {u, v});
+    } else if (contentEnd - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+      parseFace(p + 1, contentEnd, chunk);
+    }
+    line = lineEnd + 1;
+  }
+}
+} // namespace obj_detail
+
+// Parses OBJ text. The file is cut into line-aligned chunks that are parsed
+// independently on pool (or on the calling thread when pool is null) and
+// concatenated in file order, so the result does not depend on the number of
+// threads.
+inline ObjData parseObj(const char *text, size_t size, ThreadPool *pool) {
+  using namespace obj_detail;
+
+  size_t chunkCount = 1;
+  if (pool != nullptr) {
+    chunkCount = std::clamp<size_t>(size / MIN_CHUNK_BYTES, 1,
+                                    static_cast<size_t>(pool->size()) * 4);
+  }
+  std::vector<const char *> bounds{text};
+  for (size_t i = 1; i < chunkCount; i++) {
+    const char *cut = std::max(text + size * i / chunkCount, bounds.back());
+    const char *newline =
+      static_cast<const char *>(std::memchr(cut, '\n', text + size - cut));
+    bounds.push_back(newline ? newline + 1 : text + size);
+  }
+  bounds.push_back(text + size);
+
+  std::vector<ChunkResult> chunks(chunkCount);
+  auto parse = [&](size_t i) {
+    parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+  };
+  if (pool != nullptr && chunkCount > 1) {
+    pool->parallelFor(chunkCount, parse);
+  } else {
+    parse(0);
+  }
+
+  // Offsets of each chunk's records in the merged arrays
+  std::vector<size_t> positionBase(chunkCount + 1, 0);
+  std::vector<size_t> texcoordBase(chunkCount + 1, 0);
+  std::vector<size_t> cornerBase(chunkCount + 1, 0);
+  for (size_t i = 0; i < chunkCount; i++) {
+    positionBase[i + 1] = positionBase[i] + chunks[i].data.positions.size();
+    texcoordBase[i + 1] = texcoordBase[i] + chunks[i].data.texcoords.size();
+    cornerBase[i + 1] = cornerBase[i] + chunks[i].data.corners.size();
+  }
+
+  ObjData result;
+  result.positions.resize(positionBase[chunkCount]);
+  result.texcoords.resize(texcoordBase[chunkCount]);
+  result.corners.resize(cornerBase[chunkCount]);
+  auto positionCount = static_cast<int64_t>(result.positions.size() / 3);
+  auto texcoordCount = static_cast<int64_t>(result.texcoords.size() / 2);
+
+  auto merge = [&](size_t i) {
+    ChunkResult &chunk = chunks[i];
+    std::copy(chunk.data.positions.begin(), chunk.data.positions.end(),
+              result.positions.begin() + positionBase[i]);
+    std::copy(chunk.data.texcoords.begin(), chunk.data.texcoords.end(),
+              result.texcoords.begin() + texcoordBase[i]);
+    // Relative references are checked as they are resolved, so one that
+    // lands on OBJ_NO_TEXCOORD cannot pass for a face without texcoords
+    auto resolve = [](int32_t &index, size_t base, int64_t count) {
+      int64_t resolved = int64_t(index) + static_cast<int64_t>(base);
+      if (resolved < 0 || resolved >= count) {
+        throw std::runtime_error("OBJ face references a missing vertex");
+      }
+      index = static_cast<int32_t>(resolved);
+    };
+    for (uint32_t corner : chunk.relativePositions) {
+      resolve(chunk.data.corners[corner].position, positionBase[i] / 3,
+              positionCount);
+    }
+    for (uint32_t corner : chunk.relativeTexcoords) {
+      resolve(chunk.data.corners[corner].texcoord, texcoordBase[i] / 2,
+              texcoordCount);
+    }
+    for (const ObjCorner &corner : chunk.data.corners) {
+      if (corner.position < 0 || corner.position >= positionCount ||
+          corner.texcoord >= texcoordCount ||
+          (corner.texcoord < 0 && corner.texcoord != OBJ_NO_TEXCOORD)) {
+        throw std::runtime_error("OBJ face references a missing vertex");
+      }
+    }
+    std::copy(chunk.data.corners.begin(), chunk.data.corners.end(),
+              result.corners.begin() + cornerBase[i]);
+  };
+  if (pool != nullptr && chunkCount > 1) {
+    pool->parallelFor(chunkCount, merge);
+  } else {
+    merge(0);
+  }
+  return result;
+}
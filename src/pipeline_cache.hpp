@@ -0,0 +1,173 @@
+#pragma once
+
+#include "file_io.hpp"
+#include "hash.hpp"
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Bump whenever the file layout changes, so old files are ignored.
+constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+constexpr char PIPELINE_CACHE_MAGIC[8] = {'H', 'V', 'P', 'S', 'O',
+                                          '\0', '\0', '\0'};
+
+// File layout: this header, then dataSize bytes of vkGetPipelineCacheData().
+// The header names the device and driver the data came from. Drivers check
+// their own header too, but not all of them check it as strictly, and the
+// Vulkan header has no driver version in it.
+struct PipelineCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;
+  uint64_t dataHash;
+};
+
+// A VkPipelineCache kept on disk between runs, so pipelines whose shaders and
+// state have not changed skip the driver's compiler. Pipelines are built
+// through build(), which times them and asks the driver, through pipeline
+// creation feedback, whether the cache had each one.
+class PipelineCache {
+public:
+  // Creates the cache, seeded from the file at path when one written on this
+  // device and driver is there. An empty path starts empty and never saves.
+  void init(const vk::raii::Device &device,
+            const vk::raii::PhysicalDevice &physicalDevice,
+            const std::string &path) {
+    this->device = &device;
+    this->path = path;
+    expected = PipelineCacheHeader{};
+    std::memcpy(expected.magic, PIPELINE_CACHE_MAGIC, sizeof(expected.magic));
+    expected.version = PIPELINE_CACHE_VERSION;
+    vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+    expected.vendorID = properties.vendorID;
+    expected.deviceID = properties.deviceID;
+    expected.driverVersion = properties.driverVersion;
+    std::memcpy(expected.pipelineCacheUUID, properties.pipelineCacheUUID.data(),
+                VK_UUID_SIZE);
+
+    MappedFile file;
+    const std::byte *data = nullptr;
+    loadedSize = 0;
+    loadedHash = 0;
+    if (!path.empty() && file.open(path) &&
+        file.size() >= sizeof(PipelineCacheHeader)) {
+      PipelineCacheHeader header;
+      std::memcpy(&header, file.data(), sizeof(header));
+      const std::byte *payload = file.data() + sizeof(header);
+      if (matches(header) &&
+          header.dataSize == file.size() - sizeof(header) &&
+          header.dataHash == xxhash64(payload, header.dataSize)) {
+        data = payload;
+        loadedSize = header.dataSize;
+        loadedHash = header.dataHash;
+      }
+    }
+    cache = vk::raii::PipelineCache(
+      device, vk::PipelineCacheCreateInfo{.initialDataSize = loadedSize,
+                                          .pInitialData = data});
+    pipelineCount = 0;
+    hitCount = 0;
+    feedbackCount = 0;
+    buildMilliseconds = 0.0;
+  }
+
+  // Builds a graphics or compute pipeline through the cache.
+  template <typename CreateInfo>
+  vk::raii::Pipeline build(CreateInfo createInfo) {
+    vk::PipelineCreationFeedback feedback{};
+    std::vector<vk::PipelineCreationFeedback> stageFeedback(
+      stageCount(createInfo));
+    vk::PipelineCreationFeedbackCreateInfo feedbackInfo{
+      .pNext = createInfo.pNext,
+      .pPipelineCreationFeedback = &feedback,
+      .pipelineStageCreationFeedbackCount =
+        static_cast<uint32_t>(stageFeedback.size()),
+      .pPipelineStageCreationFeedbacks = stageFeedback.data()};
+    createInfo.pNext = &feedbackInfo;
+
+    auto start = std::chrono::steady_clock::now();
+    vk::raii::Pipeline pipeline(*device, cache, createInfo);
+    buildMilliseconds += std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    pipelineCount++;
+    if (feedback.flags & vk::PipelineCreationFeedbackFlagBits::eValid) {
+      feedbackCount++;
+      if (feedback.flags &
+          vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit) {
+        hitCount++;
+      }
+    }
+    return pipeline;
+  }
+
+  // Writes the cache to disk unless it holds what was loaded. Returns whether
+  // the file is now up to date.
+  bool save() const {
+    if (path.empty()) {
+      return false;
+    }
+    std::vector<uint8_t> data = cache.getData();
+    uint64_t hash = xxhash64(data.data(), data.size());
+    if (data.size() == loadedSize && hash == loadedHash) {
+      return true;
+    }
+    PipelineCacheHeader header = expected;
+    header.dataSize = data.size();
+    header.dataHash = hash;
+    std::vector<std::byte> file(sizeof(header) + data.size());
+    std::memcpy(file.data(), &header, sizeof(header));
+    std::memcpy(file.data() + sizeof(header), data.data(), data.size());
+    return writeFileAtomic(path, file.data(), file.size());
+  }
+
+  // Whether usable data was loaded from disk
+  bool loaded() const { return loadedSize > 0; }
+  size_t loadedBytes() const { return loadedSize; }
+  uint32_t pipelines() const { return pipelineCount; }
+  // Pipelines the driver reported as found in the cache, out of those it
+  // reported on at all
+  uint32_t hits() const { return hitCount; }
+  uint32_t reported() const { return feedbackCount; }
+  double milliseconds() const { return buildMilliseconds; }
+
+private:
+  bool matches(const PipelineCacheHeader &header) const {
+    return std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ==
+             0 &&
+           header.version == expected.version &&
+           header.vendorID == expected.vendorID &&
+           header.deviceID == expected.deviceID &&
+           header.driverVersion == expected.driverVersion &&
+           std::memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID,
+                       VK_UUID_SIZE) == 0;
+  }
+
+  static uint32_t stageCount(const vk::GraphicsPipelineCreateInfo &info) {
+    return info.stageCount;
+  }
+  static uint32_t stageCount(const vk::ComputePipelineCreateInfo &) {
+    return 1;
+  }
+
+  const vk::raii::Device *device = nullptr;
+  std::string path;
+  PipelineCacheHeader expected{};
+  vk::raii::PipelineCache cache = nullptr;
+  size_t loadedSize = 0;
+  uint64_t loadedHash = 0;
+  uint32_t pipelineCount = 0;
+  uint32_t hitCount = 0;
+  uint32_t feedbackCount = 0;
+  double buildMilliseconds = 0.0;
+};
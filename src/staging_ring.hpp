@@ -0,0 +1,174 @@
+#pragma once
+
+#include "device_allocator.hpp"
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+
+// Where an upload's source data goes: data is host memory to fill, buffer and
+// offset are what the copy command reads from.
+struct StagingSpan {
+  void *data = nullptr;
+  vk::Buffer buffer;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size = 0;
+};
+
+// One persistently mapped host buffer that uploads take their staging memory
+// from, front to back, wrapping around. Space handed out since the last
+// close() belongs to the submission that signals the value passed to close(),
+// and is reused once the timeline semaphore reaches that value. Requests
+// larger than the ring get a temporary buffer with the same lifetime rule.
+class StagingRing {
+public:
+  static constexpr vk::DeviceSize DEFAULT_CAPACITY = 32ull << 20;
+
+  void init(const vk::raii::Device &device, DeviceAllocator &allocator,
+            const vk::raii::Semaphore &timeline,
+            vk::DeviceSize capacity = DEFAULT_CAPACITY) {
+    this->device = &device;
+    this->allocator = &allocator;
+    this->timeline = &timeline;
+    this->capacity = capacity;
+    ring = makeBuffer(capacity, ringAllocation);
+    head = tail = closedHead = 0;
+  }
+
+  // Space for size bytes at an offset that is a multiple of alignment. Waits
+  // on the timeline when the ring is full of uploads still in flight, and
+  // throws when the uploads filling it have not been submitted yet.
+  StagingSpan allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16) {
+    while (true) {
+      if (auto span = tryAllocate(size, alignment)) {
+        return *span;
+      }
+      if (!waitOldest()) {
+        throw std::runtime_error(
+          "staging ring is full of uploads that were not submitted!");
+      }
+    }
+  }
+
+  // Like allocate(), but returns nothing instead of waiting when the ring is
+  // full.
+  std::optional<StagingSpan> tryAllocate(vk::DeviceSize size,
+                                         vk::DeviceSize alignment = 16) {
+    if (size > capacity) {
+      Oversized temporary;
+      temporary.buffer = makeBuffer(size, temporary.allocation);
+      StagingSpan span{temporary.allocation.mapped(), *temporary.buffer, 0,
+                       size};
+      openOversized.push_back(std::move(temporary));
+      return span;
+    }
+
+    for (bool reclaimed = false;; reclaimed = true) {
+      uint64_t start = (head + alignment - 1) / alignment * alignment;
+      // Never split an allocation across the end of the buffer
+      if (start % capacity + size > capacity) {
+        start += capacity - start % capacity;
+      }
+      if (start + size - tail <= capacity) {
+        head = start + size;
+        auto *base = static_cast<std::byte *>(ringAllocation.mapped());
+        return StagingSpan{base + start % capacity, *ring, start % capacity,
+                           size};
+      }
+      if (reclaimed) {
+        return std::nullopt;
+      }
+      reclaim();
+    }
+  }
+
+  // Blocks until the oldest submission still holding ring space is done and
+  // frees its space. Returns false when no submission holds any.
+  bool waitOldest() {
+    if (pending.empty()) {
+      return false;
+    }
+    waitCount++;
+    uint64_t value = pending.front().value;
+    while (device->waitSemaphores(vk::SemaphoreWaitInfo{.semaphoreCount = 1,
+                                                        .pSemaphores =
+                                                          &**timeline,
+                                                        .pValues = &value},
+                                  UINT64_MAX) == vk::Result::eTimeout)
+      ;
+    reclaim();
+    return true;
+  }
+
+  // Everything allocated since the previous close() is read by the submission
+  // that signals value.
+  void close(uint64_t value) {
+    if (head != closedHead) {
+      pending.push_back({head, value});
+      closedHead = head;
+    }
+    for (auto &temporary : openOversized) {
+      temporary.value = value;
+      oversized.push_back(std::move(temporary));
+    }
+    openOversized.clear();
+  }
+
+  // Frees the space of every submission the GPU has finished.
+  void reclaim() {
+    uint64_t completed = timeline->getCounterValue();
+    while (!pending.empty() && pending.front().value <= completed) {
+      tail = pending.front().end;
+      pending.pop_front();
+    }
+    while (!oversized.empty() && oversized.front().value <= completed) {
+      oversized.pop_front();
+    }
+  }
+
+  // Times the ring had to wait for the GPU to free space.
+  uint32_t waits() const { return waitCount; }
+
+private:
+  struct Region {
+    uint64_t end;
+    uint64_t value;
+  };
+  struct Oversized {
+    vk::raii::Buffer buffer = nullptr;
+    Allocation allocation;
+    uint64_t value = 0;
+  };
+
+  const vk::raii::Device *device = nullptr;
+  DeviceAllocator *allocator = nullptr;
+  const vk::raii::Semaphore *timeline = nullptr;
+  vk::DeviceSize capacity = 0;
+  vk::raii::Buffer ring = nullptr;
+  Allocation ringAllocation;
+
+  // Positions grow without wrapping, the buffer offset is position % capacity
+  uint64_t head = 0;
+  uint64_t tail = 0;
+  uint64_t closedHead = 0;
+  std::deque<Region> pending;
+  std::deque<Oversized> openOversized;
+  std::deque<Oversized> oversized;
+  uint32_t waitCount = 0;
+
+  vk::raii::Buffer makeBuffer(vk::DeviceSize size, Allocation &allocation) {
+    vk::raii::Buffer buffer(
+      *device,
+      vk::BufferCreateInfo{.size = size,
+                           .usage = vk::BufferUsageFlagBits::eTransferSrc,
+                           .sharingMode = vk::SharingMode::eExclusive});
+    allocation = allocator->allocate(
+      buffer, vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent);
+    return buffer;
+  }
+};
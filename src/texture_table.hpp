@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Every sampled texture in one array of combined image samplers, set 1 of the
+// graphics pipeline layout, indexed by the material ID shader.slang gets per
+// draw. Draws with different textures then share one bound descriptor set.
+//
+// The binding is partially bound and update after bind, with updates to
+// unused entries allowed while pending, so adding a texture writes a free
+// slot without waiting for frames in flight. A slot may only be removed, and
+// so reused, once no submitted frame samples it.
+class TextureTable {
+public:
+  // Upper bound on the slots; devices with lower update after bind limits get
+  // fewer
+  static constexpr uint32_t MAX_TEXTURES = 4096;
+
+  void init(const vk::raii::Device &device,
+            const vk::raii::PhysicalDevice &physicalDevice) {
+    this->device = &device;
+    auto properties = physicalDevice.getProperties2<
+      vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties>();
+    const auto &limits = properties.get<vk::PhysicalDeviceVulkan12Properties>();
+    slotCount = std::min(
+      {MAX_TEXTURES, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+       limits.maxDescriptorSetUpdateAfterBindSampledImages,
+       limits.maxDescriptorSetUpdateAfterBindSamplers});
+
+    vk::DescriptorSetLayoutBinding binding(
+      0, vk::DescriptorType::eCombinedImageSampler, slotCount,
+      vk::ShaderStageFlagBits::eFragment, nullptr);
+    vk::DescriptorBindingFlags bindingFlags =
+      vk::DescriptorBindingFlagBits::ePartiallyBound |
+      vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+      vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{
+      .bindingCount = 1, .pBindingFlags = &bindingFlags};
+    setLayout = vk::raii::DescriptorSetLayout(
+      device, vk::DescriptorSetLayoutCreateInfo{
+                .pNext = &bindingFlagsInfo,
+                .flags =
+                  vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+                .bindingCount = 1,
+                .pBindings = &binding});
+
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eCombinedImageSampler,
+                                    slotCount);
+    pool = vk::raii::DescriptorPool(
+      device, vk::DescriptorPoolCreateInfo{
+                .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet |
+                         vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+                .maxSets = 1,
+                .poolSizeCount = 1,
+                .pPoolSizes = &poolSize});
+    vk::DescriptorSetAllocateInfo allocInfo{.descriptorPool = pool,
+                                            .descriptorSetCount = 1,
+                                            .pSetLayouts = &*setLayout};
+    set = std::move(vk::raii::DescriptorSets(device, allocInfo).front());
+
+    freeSlots.clear();
+    nextSlot = 0;
+  }
+
+  const vk::raii::DescriptorSetLayout &layout() const { return setLayout; }
+  const vk::raii::DescriptorSet &descriptorSet() const { return set; }
+  uint32_t capacity() const { return slotCount; }
+  uint32_t size() const {
+    return nextSlot - static_cast<uint32_t>(freeSlots.size());
+  }
+
+  // Writes view and sampler into a free slot and returns its index.
+  uint32_t add(vk::ImageView view, vk::Sampler sampler) {
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else if (nextSlot < slotCount) {
+      slot = nextSlot++;
+    } else {
+      throw std::runtime_error("texture table is full!");
+    }
+    vk::DescriptorImageInfo imageInfo{
+      .sampler = sampler,
+      .imageView = view,
+      .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal};
+    device->updateDescriptorSets(
+      vk::WriteDescriptorSet{.dstSet = set,
+                             .dstBinding = 0,
+                             .dstArrayElement = slot,
+                             .descriptorCount = 1,
+                             .descriptorType =
+                               vk::DescriptorType::eCombinedImageSampler,
+                             .pImageInfo = &imageInfo},
+      {});
+    return slot;
+  }
+
+  // Makes slot free for reuse. Its descriptor is left as it is, which the
+  // partially bound binding allows as long as no draw reads it.
+  void remove(uint32_t slot) { freeSlots.push_back(slot); }
+
+private:
+  const vk::raii::Device *device = nullptr;
+  vk::raii::DescriptorSetLayout setLayout = nullptr;
+  vk::raii::DescriptorPool pool = nullptr;
+  vk::raii::DescriptorSet set = nullptr;
+  uint32_t slotCount = 0;
+  uint32_t nextSlot = 0;
+  std::vector<uint32_t> freeSlots;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO of tasks.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency()) {
+    threadCount = std::max(threadCount, 1u);
+    for (unsigned i = 0; i < threadCount; i++) {
+      workers.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+  template <typename F>
+  auto submit(F &&task) -> std::future<std::invoke_result_t<F>> {
+    using Result = std::invoke_result_t<F>;
+    auto packaged =
+      std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    std::future<Result> future = packaged->get_future();
+    {
+      std::lock_guard lock(mutex);
+      tasks.emplace_back([packaged] { (*packaged)(); });
+    }
+    wake.notify_one();
+    return future;
+  }
+
+  // Calls body(i) for every i in [0, count) on the workers and the calling
+  // thread, returning once all calls are done. Rethrows the first exception.
+  // Must not be called from inside a task of the same pool.
+  template <typename F> void parallelFor(size_t count, F &&body) {
+    if (count == 0) {
+      return;
+    }
+    auto next = std::make_shared<std::atomic<size_t>>(0);
+    auto drain = [next, count, &body] {
+      for (size_t i = next->fetch_add(1); i < count; i = next->fetch_add(1)) {
+        body(i);
+      }
+    };
+    std::vector<std::future<void>> helpers;
+    size_t helperCount = std::min<size_t>(size(), count - 1);
+    for (size_t i = 0; i < helperCount; i++) {
+      helpers.push_back(submit(drain));
+    }
+    // Helpers reference body, so they have to finish even if a call throws
+    std::exception_ptr error;
+    try {
+      drain();
+    } catch (...) {
+      error = std::current_exception();
+      next->store(count);
+    }
+    for (auto &helper : helpers) {
+      try {
+        helper.get();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void workerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
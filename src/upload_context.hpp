@@ -0,0 +1,307 @@
+#pragma once
+
+#include "device_allocator.hpp"
+#include "staging_ring.hpp"
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+
+// Collects uploads, meaning staging copies, layout transitions and mip blits,
+// into command buffers that go to the queues in a single submission each.
+// Copies run on a dedicated transfer queue when the device has one, so they
+// overlap rendering; work only a graphics queue can do (blits, shader stage
+// barriers) is recorded separately and submitted to the graphics queue, which
+// waits for the copies on the GPU. Every submission signals the next value of
+// a timeline semaphore, which is also what the staging ring reclaims space by.
+// Each transfer submission waits for the graphics submission before it, so
+// the lanes signal their values in order: reaching a value means every
+// submission up to it has finished, whichever queue it went to. Objects the
+// recorded commands use but nothing else owns are retained until then too.
+class UploadContext {
+public:
+  void init(const vk::raii::Device &device, DeviceAllocator &allocator,
+            const vk::raii::Queue &transferQueue, uint32_t transferFamily,
+            const vk::raii::Queue &graphicsQueue, uint32_t graphicsFamily) {
+    this->device = &device;
+    vk::SemaphoreTypeCreateInfo timelineInfo{
+      .semaphoreType = vk::SemaphoreType::eTimeline, .initialValue = 0};
+    timeline =
+      vk::raii::Semaphore(device, vk::SemaphoreCreateInfo{.pNext = &timelineInfo});
+    initLane(transfer, transferQueue, transferFamily);
+    initLane(graphics, graphicsQueue, graphicsFamily);
+    ring.init(device, allocator, timeline);
+  }
+
+  // Whether copies run on a queue family other than graphics.
+  bool hasTransferQueue() const { return transfer.family != graphics.family; }
+  uint32_t transferFamily() const { return transfer.family; }
+
+  // Command buffer of the open batch for copies and transfer stage barriers.
+  const vk::raii::CommandBuffer &commandBuffer() {
+    return laneCommandBuffer(transfer);
+  }
+
+  // Command buffer of the open batch for graphics queue work that follows the
+  // copies. Resources written by commandBuffer() must be handed over first.
+  const vk::raii::CommandBuffer &graphicsCommandBuffer() {
+    return hasTransferQueue() ? laneCommandBuffer(graphics)
+                              : laneCommandBuffer(transfer);
+  }
+
+  // Makes the copies into buffer visible to dstStage on the graphics queue:
+  // a queue family ownership release and acquire with a transfer queue, a
+  // plain barrier without one.
+  void handOff(vk::Buffer buffer, vk::PipelineStageFlags2 dstStage,
+               vk::AccessFlags2 dstAccess) {
+    vk::BufferMemoryBarrier2 barrier{
+      .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+      .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+      .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+      .buffer = buffer,
+      .offset = 0,
+      .size = vk::WholeSize};
+    if (!hasTransferQueue()) {
+      commandBuffer().pipelineBarrier2(vk::DependencyInfo{
+        .bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &barrier});
+      return;
+    }
+    barrier.srcQueueFamilyIndex = transfer.family;
+    barrier.dstQueueFamilyIndex = graphics.family;
+    auto release = barrier;
+    release.dstStageMask = vk::PipelineStageFlagBits2::eNone;
+    release.dstAccessMask = vk::AccessFlagBits2::eNone;
+    commandBuffer().pipelineBarrier2(vk::DependencyInfo{
+      .bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &release});
+    auto acquire = barrier;
+    acquire.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+    acquire.srcAccessMask = vk::AccessFlagBits2::eNone;
+    graphicsCommandBuffer().pipelineBarrier2(vk::DependencyInfo{
+      .bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &acquire});
+  }
+
+  // Same for an image, changing its layout from oldLayout to newLayout on
+  // the way.
+  void handOff(vk::Image image, const vk::ImageSubresourceRange &range,
+               vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
+               vk::PipelineStageFlags2 dstStage, vk::AccessFlags2 dstAccess) {
+    vk::ImageMemoryBarrier2 barrier{
+      .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+      .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .oldLayout = oldLayout,
+      .newLayout = newLayout,
+      .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+      .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+      .image = image,
+      .subresourceRange = range};
+    if (!hasTransferQueue()) {
+      commandBuffer().pipelineBarrier2(vk::DependencyInfo{
+        .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &barrier});
+      return;
+    }
+    barrier.srcQueueFamilyIndex = transfer.family;
+    barrier.dstQueueFamilyIndex = graphics.family;
+    auto release = barrier;
+    release.dstStageMask = vk::PipelineStageFlagBits2::eNone;
+    release.dstAccessMask = vk::AccessFlagBits2::eNone;
+    commandBuffer().pipelineBarrier2(vk::DependencyInfo{
+      .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &release});
+    auto acquire = barrier;
+    acquire.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+    acquire.srcAccessMask = vk::AccessFlagBits2::eNone;
+    graphicsCommandBuffer().pipelineBarrier2(vk::DependencyInfo{
+      .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &acquire});
+  }
+
+  // Staging space for the open batch. When the ring is full of this batch's
+  // own data the batch is submitted early to make room, which needs the
+  // batch to have recorded the copies of that data already.
+  StagingSpan stage(vk::DeviceSize size, vk::DeviceSize alignment = 16) {
+    while (true) {
+      if (auto span = ring.tryAllocate(size, alignment)) {
+        return *span;
+      }
+      if (!ring.waitOldest()) {
+        if (!transfer.recording && !graphics.recording) {
+          throw std::runtime_error(
+            "staging ring is full of uploads that were not recorded!");
+        }
+        submit();
+      }
+    }
+  }
+
+  // Keeps resource alive until the open batch has finished.
+  template <typename T> void retain(T resource) {
+    retainedObjects.push_back(
+      {~0ull, std::make_shared<T>(std::move(resource))});
+  }
+  // Objects retain() holds, released or not
+  size_t retained() {
+    release();
+    return retainedObjects.size();
+  }
+
+  // Submits the open batch and returns the timeline value that signals its
+  // completion. With nothing recorded, returns the value of the last
+  // submission, and staging taken since stays with the open batch: that
+  // value may already have been reached.
+  uint64_t submit() {
+    if (!transfer.recording && !graphics.recording) {
+      return value;
+    }
+    if (transfer.recording) {
+      submitLane(transfer, graphicsValue);
+    }
+    if (graphics.recording) {
+      // The graphics part waits for the copies on the GPU, not the host
+      submitLane(graphics, value);
+      graphicsValue = value;
+    }
+    ring.close(value);
+    for (auto it = retainedObjects.rbegin();
+         it != retainedObjects.rend() && it->value == ~0ull; ++it) {
+      it->value = value;
+    }
+    release();
+    return value;
+  }
+
+  // Blocks until the submission that signals target has finished.
+  void wait(uint64_t target) {
+    if (timeline.getCounterValue() >= target) {
+      return;
+    }
+    stallCount++;
+    while (device->waitSemaphores(vk::SemaphoreWaitInfo{.semaphoreCount = 1,
+                                                        .pSemaphores =
+                                                          &*timeline,
+                                                        .pValues = &target},
+                                  UINT64_MAX) == vk::Result::eTimeout)
+      ;
+    release();
+  }
+
+  // Submits the open batch and waits for it.
+  void flush() { wait(submit()); }
+
+  const vk::raii::Semaphore &semaphore() const { return timeline; }
+  uint32_t submits() const { return submitCount; }
+  // Host waits on uploads, including the staging ring waiting for space.
+  uint32_t stalls() const { return stallCount + ring.waits(); }
+
+private:
+  struct Submission {
+    vk::raii::CommandBuffer commandBuffer = nullptr;
+    uint64_t value = 0;
+  };
+
+  // ~0 until the batch it was retained for is submitted
+  struct Retained {
+    uint64_t value;
+    std::shared_ptr<void> object;
+  };
+
+  // Command buffers for one queue, in submission order and reused once their
+  // value is reached
+  struct Lane {
+    const vk::raii::Queue *queue = nullptr;
+    uint32_t family = 0;
+    vk::raii::CommandPool commandPool = nullptr;
+    std::deque<Submission> inFlight;
+    vk::raii::CommandBuffer *recording = nullptr;
+  };
+
+  const vk::raii::Device *device = nullptr;
+  vk::raii::Semaphore timeline = nullptr;
+  Lane transfer;
+  Lane graphics;
+  StagingRing ring;
+  uint64_t value = 0;
+  // Value of the last graphics submission, which the next transfer one waits
+  // for so it cannot signal first
+  uint64_t graphicsValue = 0;
+  uint32_t submitCount = 0;
+  uint32_t stallCount = 0;
+  // In the order retained, so also in the order their values are reached
+  std::deque<Retained> retainedObjects;
+
+  // Drops what was retained for batches that have finished
+  void release() {
+    uint64_t completed = timeline.getCounterValue();
+    while (!retainedObjects.empty() &&
+           retainedObjects.front().value <= completed) {
+      retainedObjects.pop_front();
+    }
+  }
+
+  void initLane(Lane &lane, const vk::raii::Queue &queue, uint32_t family) {
+    lane.queue = &queue;
+    lane.family = family;
+    lane.commandPool = vk::raii::CommandPool(
+      *device,
+      vk::CommandPoolCreateInfo{
+        .flags = vk::CommandPoolCreateFlagBits::eTransient |
+                 vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+        .queueFamilyIndex = family});
+  }
+
+  const vk::raii::CommandBuffer &laneCommandBuffer(Lane &lane) {
+    if (lane.recording) {
+      return *lane.recording;
+    }
+    if (!lane.inFlight.empty() &&
+        lane.inFlight.front().value <= timeline.getCounterValue()) {
+      Submission reused = std::move(lane.inFlight.front());
+      lane.inFlight.pop_front();
+      reused.commandBuffer.reset();
+      lane.inFlight.push_back(std::move(reused));
+    } else {
+      vk::CommandBufferAllocateInfo allocInfo{
+        .commandPool = lane.commandPool,
+        .level = vk::CommandBufferLevel::ePrimary,
+        .commandBufferCount = 1};
+      lane.inFlight.push_back(
+        {std::move(vk::raii::CommandBuffers(*device, allocInfo).front()), 0});
+    }
+    lane.inFlight.back().value = ~0ull;
+    lane.recording = &lane.inFlight.back().commandBuffer;
+    lane.recording->begin(vk::CommandBufferBeginInfo{
+      .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    return *lane.recording;
+  }
+
+  // Ends and submits the lane's command buffer, waiting for waitValue on the
+  // GPU first when it is not 0, and signalling the next timeline value.
+  void submitLane(Lane &lane, uint64_t waitValue) {
+    lane.recording->end();
+    value++;
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{
+      .waitSemaphoreValueCount = waitValue > 0 ? 1u : 0u,
+      .pWaitSemaphoreValues = &waitValue,
+      .signalSemaphoreValueCount = 1,
+      .pSignalSemaphoreValues = &value};
+    vk::SubmitInfo submitInfo{.pNext = &timelineInfo,
+                              .waitSemaphoreCount = waitValue > 0 ? 1u : 0u,
+                              .pWaitSemaphores = &*timeline,
+                              .pWaitDstStageMask = &waitStage,
+                              .commandBufferCount = 1,
+                              .pCommandBuffers = &**lane.recording,
+                              .signalSemaphoreCount = 1,
+                              .pSignalSemaphores = &*timeline};
+    lane.queue->submit(submitInfo, nullptr);
+    lane.inFlight.back().value = value;
+    lane.recording = nullptr;
+    submitCount++;
+  }
+};
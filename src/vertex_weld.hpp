@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Welds identical vertices while building an indexed mesh. Open addressing
+// with linear probing; a slot stores the upper hash bits and the index of the
+// vertex in the output array, so most mismatches are rejected without touching
+// the vertex itself and every vertex is hashed exactly once.
+//
+// Hash must map equal vertices (by operator==) to equal 64-bit values.
+template <typename V, typename Hash> class VertexWeldTable {
+public:
+  // maxVertices is an upper bound on the number of unique vertices, usually
+  // the index count. Sizing from it up front means the table never rehashes.
+  VertexWeldTable(std::vector<V> &vertices, size_t maxVertices)
+      : vertices(vertices) {
+    size_t capacity = 16;
+    while (capacity < maxVertices * 2) {
+      capacity <<= 1;
+    }
+    slots.assign(capacity, Slot{0, EMPTY});
+    mask = capacity - 1;
+  }
+
+  // Index of vertex in the output array, appending it if it is new.
+  uint32_t insert(const V &vertex) {
+    if ((vertices.size() + 1) * 2 > slots.size()) {
+      grow();
+    }
+    uint64_t hash = hasher(vertex);
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+      Slot &slot = slots[i];
+      if (slot.index == EMPTY) {
+        slot = {tag, static_cast<uint32_t>(vertices.size())};
+        vertices.push_back(vertex);
+        return slot.index;
+      }
+      if (slot.tag == tag && vertices[slot.index] == vertex) {
+        return slot.index;
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t EMPTY = ~0u;
+
+  struct Slot {
+    uint32_t tag;
+    uint32_t index;
+  };
+
+  std::vector<V> &vertices;
+  std::vector<Slot> slots;
+  size_t mask = 0;
+  Hash hasher;
+
+  // Only reached when maxVertices was an underestimate
+  void grow() {
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(old.size() * 2, Slot{0, EMPTY});
+    mask = slots.size() - 1;
+    for (const Slot &slot : old) {
+      if (slot.index == EMPTY) {
+        continue;
+      }
+      uint64_t hash = hasher(vertices[slot.index]);
+      size_t i = static_cast<size_t>(hash) & mask;
+      while (slots[i].index != EMPTY) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = slot;
+    }
+  }
+};